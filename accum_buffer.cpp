@@ -0,0 +1,125 @@
+#include "accum_buffer.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+namespace {
+constexpr std::size_t HUGE_PAGE = 2u << 20;   // x86-64 / aarch64 default
+}
+
+/* --------------------------------------------------------------------- */
+bool parse_huge_pages(const std::string& s, HugePages& hp)
+{
+  if (s == "off")      { hp = HugePages::Off;         return true; }
+  if (s == "thp")      { hp = HugePages::Transparent; return true; }
+  if (s == "explicit") { hp = HugePages::Explicit;    return true; }
+  return false;
+}
+
+/* --------------------------------------------------------------------- */
+AccumBuffer::AccumBuffer(std::size_t n, HugePages hp) : size_(n), hp_(hp)
+{
+  if (n == 0) { hp_ = HugePages::Off; return; }
+  const std::size_t want = n * sizeof(float);
+
+  if (hp == HugePages::Explicit) {
+    bytes_ = (want + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    base_  = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base_ == MAP_FAILED) {
+      std::cerr << "Warning: no explicit huge pages available for "
+                << (want >> 20) << " MiB, using transparent huge pages\n";
+      base_ = nullptr;
+      hp_   = HugePages::Transparent;
+    }
+  }
+
+  if (!base_) {
+    // over-allocate by one huge page so the data can start on a 2 MiB
+    // boundary, which THP needs to back it with huge pages from the start
+    // (no MAP_NORESERVE: an accumulator that cannot be committed must fail
+    // here, not get the process OOM-killed when its pages are first touched)
+    const std::size_t pad = hp_ == HugePages::Transparent ? HUGE_PAGE : 0;
+    bytes_ = want + pad;
+    base_  = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base_ == MAP_FAILED) {
+      base_ = nullptr;
+      throw std::runtime_error("Memory allocation failed for " +
+                               std::to_string(want >> 20) + " MiB accumulator");
+    }
+  }
+
+  auto addr = reinterpret_cast<std::uintptr_t>(base_);
+  if (hp_ == HugePages::Transparent) {
+    addr = (addr + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+#ifdef MADV_HUGEPAGE
+    if (madvise(reinterpret_cast<void*>(addr), want, MADV_HUGEPAGE) != 0)
+      hp_ = HugePages::Off;
+#else
+    hp_ = HugePages::Off;
+#endif
+  }
+  data_ = reinterpret_cast<float*>(addr);
+}
+
+AccumBuffer::~AccumBuffer() { release(); }
+
+void AccumBuffer::release()
+{
+  if (base_) munmap(base_, bytes_);
+  data_ = nullptr; size_ = 0; base_ = nullptr; bytes_ = 0;
+}
+
+AccumBuffer::AccumBuffer(AccumBuffer&& o) noexcept { *this = std::move(o); }
+
+AccumBuffer& AccumBuffer::operator=(AccumBuffer&& o) noexcept
+{
+  if (this != &o) {
+    release();
+    data_  = std::exchange(o.data_, nullptr);
+    size_  = std::exchange(o.size_, 0);
+    base_  = std::exchange(o.base_, nullptr);
+    bytes_ = std::exchange(o.bytes_, 0);
+    hp_    = o.hp_;
+  }
+  return *this;
+}
+
+void AccumBuffer::first_touch(std::size_t begin, std::size_t end)
+{
+  const std::size_t page = hp_ == HugePages::Off
+                               ? static_cast<std::size_t>(sysconf(_SC_PAGESIZE))
+                               : HUGE_PAGE;
+  const std::size_t step = page / sizeof(float);
+  volatile float* p = data_;
+  for (std::size_t i = begin; i < end; i += step) p[i] = 0.0f;
+  if (end > begin) p[end - 1] = 0.0f;   // tail page when begin is unaligned
+}
+
+/* --------------------------------------------------------------------- */
+int numa_nodes()
+{
+#ifdef HAVE_LIBNUMA
+  if (numa_available() >= 0) return numa_num_configured_nodes();
+#endif
+  return 1;
+}
+
+bool pin_to_node(int node)
+{
+#ifdef HAVE_LIBNUMA
+  if (numa_available() >= 0) return numa_run_on_node(node) == 0;
+#else
+  (void)node;
+#endif
+  return false;
+}
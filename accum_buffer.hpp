@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+------------------------------------------------------------------------------
+ Zero-initialised float buffer for the accumulator (and per-thread partials)
+ - Anonymous mmap: pages come from the kernel already zeroed and are only
+   placed when first written, so the thread that touches a band first owns
+   it on a NUMA machine (see first_touch()).
+ - Optional huge pages: transparent (madvise) or explicit (MAP_HUGETLB,
+   falls back to transparent if the pool is empty) to cut TLB misses on
+   multi-GB matrices.
+------------------------------------------------------------------------------
+*/
+
+enum class HugePages { Off, Transparent, Explicit };
+
+// "off", "thp" or "explicit"; returns false on anything else
+bool parse_huge_pages(const std::string& s, HugePages& hp);
+
+class AccumBuffer {
+public:
+  AccumBuffer() = default;
+  explicit AccumBuffer(std::size_t n, HugePages hp = HugePages::Off);
+  ~AccumBuffer();
+  AccumBuffer(AccumBuffer&& o) noexcept;
+  AccumBuffer& operator=(AccumBuffer&& o) noexcept;
+  AccumBuffer(const AccumBuffer&)            = delete;
+  AccumBuffer& operator=(const AccumBuffer&) = delete;
+
+  float*       data()       { return data_; }
+  const float* data() const { return data_; }
+  std::size_t  size() const { return size_; }
+  bool         empty() const { return size_ == 0; }
+  float&       operator[](std::size_t i)       { return data_[i]; }
+  const float& operator[](std::size_t i) const { return data_[i]; }
+
+  // Write one zero per page of [begin, end) so those pages are placed on
+  // the calling thread's NUMA node now rather than wherever they are
+  // first accumulated into.
+  void first_touch(std::size_t begin, std::size_t end);
+
+  HugePages huge_pages() const { return hp_; }   // what was actually obtained
+
+private:
+  void release();
+
+  float*      data_  = nullptr;
+  std::size_t size_  = 0;
+  void*       base_  = nullptr;   // mapping as returned by mmap
+  std::size_t bytes_ = 0;
+  HugePages   hp_    = HugePages::Off;
+};
+
+// NUMA helpers; no-ops returning 1 / false without libnuma (HAVE_LIBNUMA)
+int  numa_nodes();
+bool pin_to_node(int node);   // run the calling thread on `node` only
@@ -0,0 +1,297 @@
+#include "async_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+bool parse_read_backend(const std::string& s, ReadBackend& backend)
+{
+  if (s == "sync")  { backend = ReadBackend::Sync;  return true; }
+  if (s == "pread") { backend = ReadBackend::Pread; return true; }
+  if (s == "uring") { backend = ReadBackend::Uring; return true; }
+  return false;
+}
+
+namespace {
+
+constexpr std::size_t PAGE = 4096;
+
+struct FreeDeleter { void operator()(void* p) const { std::free(p); } };
+using AlignedBuf = std::unique_ptr<unsigned char, FreeDeleter>;
+
+AlignedBuf aligned_buf(std::size_t n)
+{
+  void* p = nullptr;
+  if (posix_memalign(&p, PAGE, n) != 0) throw std::bad_alloc();
+  return AlignedBuf(static_cast<unsigned char*>(p));
+}
+
+int open_file(const std::string& path)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open " + path);
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return fd;
+}
+
+// pread that retries on EINTR; fills as much of [buf, buf + n) as the file has
+ssize_t pread_full(int fd, unsigned char* buf, std::size_t n, std::uint64_t off)
+{
+  std::size_t done = 0;
+  while (done < n) {
+    const ssize_t got = ::pread(fd, buf + done, n - done, static_cast<off_t>(off + done));
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) return -1;
+    if (got == 0) break;
+    done += static_cast<std::size_t>(got);
+  }
+  return static_cast<ssize_t>(done);
+}
+
+/* ---- pread on a helper thread ----------------------------------------- */
+class PreadSource : public ByteSource {
+public:
+  PreadSource(const std::string& path, std::size_t block, unsigned depth)
+    : path_(path), block_(block), slot_(depth)
+  {
+    for (auto& s : slot_) s.buf = aligned_buf(block);
+    fd_     = open_file(path);
+    thread_ = std::thread([this] { fill(); });
+  }
+  ~PreadSource() override
+  {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    ::close(fd_);
+  }
+
+  bool next(const unsigned char*& data, std::size_t& len) override
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (holding_) {   // hand the previous block back to the reader
+      slot_[head_].full = false;
+      head_    = (head_ + 1) % slot_.size();
+      holding_ = false;
+      cv_.notify_all();
+    }
+    cv_.wait(lk, [&] { return slot_[head_].full || done_; });
+    if (!slot_[head_].full) {
+      if (err_) throw std::runtime_error("Read error in " + path_ + ": " + std::strerror(err_));
+      return false;
+    }
+    data     = slot_[head_].buf.get();
+    len      = slot_[head_].len;
+    holding_ = true;
+    return true;
+  }
+
+private:
+  void fill()
+  {
+    std::uint64_t off  = 0;
+    std::size_t   tail = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [&] { return stop_ || !slot_[tail].full; });
+        if (stop_) return;
+      }
+      const ssize_t got = pread_full(fd_, slot_[tail].buf.get(), block_, off);
+      std::lock_guard<std::mutex> lk(mu_);
+      if (got <= 0) {
+        if (got < 0) err_ = errno;
+        done_ = true;
+        cv_.notify_all();
+        return;
+      }
+      slot_[tail].len  = static_cast<std::size_t>(got);
+      slot_[tail].full = true;
+      off  += static_cast<std::uint64_t>(got);
+      tail  = (tail + 1) % slot_.size();
+      cv_.notify_all();
+    }
+  }
+
+  struct Slot {
+    AlignedBuf  buf;
+    std::size_t len  = 0;
+    bool        full = false;
+  };
+
+  std::string             path_;
+  std::size_t             block_;
+  int                     fd_ = -1;
+  std::vector<Slot>       slot_;
+  std::size_t             head_ = 0;
+  bool                    holding_ = false;   // slot_[head_] is lent to the caller
+  bool                    done_ = false, stop_ = false;
+  int                     err_  = 0;
+  std::mutex              mu_;
+  std::condition_variable cv_;
+  std::thread             thread_;
+};
+
+#ifdef HAVE_LIBURING
+/* ---- io_uring: the reads are queued in the kernel ---------------------- */
+class UringSource : public ByteSource {
+public:
+  // null if the kernel refuses the ring (old kernel, seccomp, ...)
+  static std::unique_ptr<UringSource> create(const std::string& path, std::size_t block,
+                                             unsigned depth, int& why)
+  {
+    std::unique_ptr<UringSource> s(new UringSource(path, block, depth));
+    why = -io_uring_queue_init(depth, &s->ring_, 0);
+    if (why != 0) return nullptr;
+    s->ready_ = true;
+    for (std::size_t k = 0; k < s->slot_.size(); ++k) s->submit(k);
+    io_uring_submit(&s->ring_);
+    return s;
+  }
+
+  ~UringSource() override
+  {
+    if (ready_) {
+      // the kernel may still be writing into the buffers: wait for them
+      for (; inFlight_ > 0; --inFlight_) {
+        io_uring_cqe* cqe = nullptr;
+        if (io_uring_wait_cqe(&ring_, &cqe) < 0) break;
+        io_uring_cqe_seen(&ring_, cqe);
+      }
+      io_uring_queue_exit(&ring_);
+    }
+    ::close(fd_);
+  }
+
+  bool next(const unsigned char*& data, std::size_t& len) override
+  {
+    if (holding_) {   // reuse the previous block's buffer for a later read
+      holding_ = false;
+      submit(head_);
+      io_uring_submit(&ring_);
+      head_ = (head_ + 1) % slot_.size();
+    }
+    Slot& s = slot_[head_];
+    if (s.state == Idle) return false;   // nothing left to read
+    while (s.state != Done) reap();
+
+    data     = s.buf.get();
+    len      = s.len;
+    holding_ = true;
+    s.state  = Idle;
+    return true;
+  }
+
+private:
+  enum State { Idle, InFlight, Done };
+
+  struct Slot {
+    AlignedBuf    buf;
+    std::uint64_t off = 0;
+    std::size_t   len = 0;
+    State         state = Idle;
+  };
+
+  UringSource(const std::string& path, std::size_t block, unsigned depth)
+    : path_(path), block_(block), slot_(depth)
+  {
+    for (auto& s : slot_) s.buf = aligned_buf(block);
+    fd_ = open_file(path);
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) { ::close(fd_); throw std::runtime_error("Cannot stat " + path); }
+    size_ = static_cast<std::uint64_t>(st.st_size);
+  }
+
+  // queue the next block of the file into slot k (nothing past the end)
+  void submit(std::size_t k)
+  {
+    if (next_ >= size_) return;
+    Slot& s = slot_[k];
+    s.off   = next_;
+    s.len   = static_cast<std::size_t>(std::min<std::uint64_t>(block_, size_ - next_));
+    s.state = InFlight;
+    next_  += s.len;
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring_);   // never full: one entry per slot
+    io_uring_prep_read(sqe, fd_, s.buf.get(), static_cast<unsigned>(s.len), s.off);
+    io_uring_sqe_set_data(sqe, &s);
+    ++inFlight_;
+  }
+
+  // wait for one completion
+  void reap()
+  {
+    io_uring_cqe* cqe = nullptr;
+    const int rc = io_uring_wait_cqe(&ring_, &cqe);
+    if (rc == -EINTR) return;
+    if (rc < 0) throw std::runtime_error("io_uring wait failed for " + path_ + ": " + std::strerror(-rc));
+    Slot& s = *static_cast<Slot*>(io_uring_cqe_get_data(cqe));
+    const int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    --inFlight_;
+    if (res < 0) throw std::runtime_error("Read error in " + path_ + ": " + std::strerror(-res));
+
+    // a short read is rare on regular files: finish the block synchronously
+    const std::size_t got = static_cast<std::size_t>(res);
+    if (got < s.len) {
+      const ssize_t more = pread_full(fd_, s.buf.get() + got, s.len - got, s.off + got);
+      if (more < 0) throw std::runtime_error("Read error in " + path_ + ": " + std::strerror(errno));
+      s.len = got + static_cast<std::size_t>(more);
+    }
+    s.state = Done;
+  }
+
+  std::string       path_;
+  std::size_t       block_;
+  int               fd_ = -1;
+  std::uint64_t     size_ = 0, next_ = 0;   // file size, offset of the next read
+  std::vector<Slot> slot_;
+  std::size_t       head_ = 0;
+  bool              holding_ = false;
+  unsigned          inFlight_ = 0;
+  bool              ready_ = false;
+  io_uring          ring_{};
+};
+#endif
+
+} // namespace
+
+std::unique_ptr<ByteSource> open_read_ahead(const std::string& path, ReadBackend backend,
+                                            std::size_t block, unsigned depth)
+{
+  block = std::max(PAGE, (block + PAGE - 1) / PAGE * PAGE);
+  depth = std::max(2u, depth);
+  if (backend == ReadBackend::Uring) {
+    static std::once_flag warned;
+#ifdef HAVE_LIBURING
+    int why = 0;
+    if (auto s = UringSource::create(path, block, depth, why)) return s;
+    std::call_once(warned, [why] {
+      std::cerr << "Warning: io_uring unavailable (" << std::strerror(why)
+                << "), reading with pread instead\n";
+    });
+#else
+    std::call_once(warned, [] {
+      std::cerr << "Warning: built without liburing, reading with pread instead\n";
+    });
+#endif
+  }
+  return std::make_unique<PreadSource>(path, block, depth);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/*
+------------------------------------------------------------------------------
+ Read-ahead sources for compressed inputs: several large reads stay in
+ flight, so the decompressor works on one block while the next ones are
+ still arriving and never blocks in a synchronous read() – even with a
+ single worker.
+   sync   the decoders do their own reads (gzread, read(2)), as before
+   pread  a helper thread reads ahead into a ring of buffers
+   uring  io_uring keeps the reads queued in the kernel (liburing,
+          HAVE_LIBURING); falls back to pread when it was not built in or
+          the kernel refuses the ring
+ Used for whole-file reads; split work units seek and keep their readers.
+------------------------------------------------------------------------------
+*/
+
+enum class ReadBackend { Sync, Pread, Uring };
+
+// "sync", "pread" or "uring"; returns false on anything else
+bool parse_read_backend(const std::string& s, ReadBackend& backend);
+
+// Bytes of one input, front to back, a block at a time.
+class ByteSource {
+public:
+  virtual ~ByteSource() = default;
+  // next block, valid until the following call; false at end of input.
+  // Throws on read errors.
+  virtual bool next(const unsigned char*& data, std::size_t& len) = 0;
+};
+
+// Regular file `path` from its first byte, `depth` reads of `block` bytes
+// (a multiple of 4 KiB, into page-aligned buffers) in flight.
+std::unique_ptr<ByteSource> open_read_ahead(const std::string& path, ReadBackend backend,
+                                            std::size_t block = std::size_t{1} << 20,
+                                            unsigned depth = 4);
@@ -0,0 +1,261 @@
+#include "bgzf.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/types.h>
+#include <zlib.h>
+
+namespace {
+
+constexpr std::size_t BLOCK_DATA = 0xff00;   // uncompressed bytes per block
+constexpr std::size_t BLOCK_MAX  = 0x10000;  // hard limit on a whole block
+constexpr std::size_t HEADER_SZ  = 18;
+constexpr std::size_t FOOTER_SZ  = 8;
+
+// empty block htslib appends to mark a complete file
+const unsigned char EOF_BLOCK[28] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+  0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00
+};
+
+void put_le16(unsigned char* p, std::uint32_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; }
+void put_le32(unsigned char* p, std::uint32_t v)
+{
+  for (int i = 0; i < 4; ++i) p[i] = static_cast<unsigned char>((v >> (8 * i)) & 0xff);
+}
+std::uint32_t get_le16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+std::uint32_t get_le32(const unsigned char* p)
+{
+  return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) |
+         (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+bool header_ok(const unsigned char* h)
+{
+  return h[0] == 0x1f && h[1] == 0x8b && h[2] == 8 && (h[3] & 4) &&
+         get_le16(h + 10) == 6 && h[12] == 'B' && h[13] == 'C' &&
+         get_le16(h + 14) == 2;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------
+   Writer
+   --------------------------------------------------------------------- */
+BgzfWriter::BgzfWriter(const std::string& path, int level)
+  : path_(path), level_(level)
+{
+  fh_ = std::fopen(path.c_str(), "wb");
+  if (!fh_) throw std::runtime_error("Cannot create output " + path);
+  buf_.reserve(BLOCK_DATA);
+  out_.resize(BLOCK_MAX);
+}
+
+BgzfWriter::~BgzfWriter()
+{
+  if (fh_) std::fclose(fh_);   // close() not reached: error path, drop data
+}
+
+void BgzfWriter::write(const void* data, std::size_t n)
+{
+  const char* p = static_cast<const char*>(data);
+  while (n) {
+    const std::size_t k = std::min(n, BLOCK_DATA - buf_.size());
+    buf_.insert(buf_.end(), p, p + k);
+    p += k; n -= k;
+    if (buf_.size() == BLOCK_DATA) flush_block();
+  }
+}
+
+void BgzfWriter::flush_block()
+{
+  if (buf_.empty()) return;
+
+  z_stream zs{};
+  if (deflateInit2(&zs, level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("deflateInit2 failed for " + path_);
+  zs.next_in   = reinterpret_cast<Bytef*>(buf_.data());
+  zs.avail_in  = static_cast<uInt>(buf_.size());
+  zs.next_out  = out_.data() + HEADER_SZ;
+  zs.avail_out = static_cast<uInt>(BLOCK_MAX - HEADER_SZ - FOOTER_SZ);
+  const int rc = deflate(&zs, Z_FINISH);
+  const std::size_t clen = zs.total_out;
+  deflateEnd(&zs);
+  if (rc != Z_STREAM_END) throw std::runtime_error("BGZF block overflow in " + path_);
+
+  const std::size_t bsize = HEADER_SZ + clen + FOOTER_SZ;
+  unsigned char* h = out_.data();
+  h[0] = 0x1f; h[1] = 0x8b; h[2] = 8; h[3] = 4;
+  put_le32(h + 4, 0); h[8] = 0; h[9] = 0xff;
+  put_le16(h + 10, 6); h[12] = 'B'; h[13] = 'C'; put_le16(h + 14, 2);
+  put_le16(h + 16, static_cast<std::uint32_t>(bsize - 1));
+
+  unsigned char* f = out_.data() + HEADER_SZ + clen;
+  const uLong crc = crc32(crc32(0L, Z_NULL, 0),
+                          reinterpret_cast<const Bytef*>(buf_.data()),
+                          static_cast<uInt>(buf_.size()));
+  put_le32(f, static_cast<std::uint32_t>(crc));
+  put_le32(f + 4, static_cast<std::uint32_t>(buf_.size()));
+
+  if (std::fwrite(out_.data(), 1, bsize, fh_) != bsize)
+    throw std::runtime_error("Write error on " + path_);
+  coffset_ += bsize;
+  buf_.clear();
+}
+
+void BgzfWriter::write_raw(const void* blocks, std::size_t n)
+{
+  flush_block();
+  if (n && std::fwrite(blocks, 1, n, fh_) != n)
+    throw std::runtime_error("Write error on " + path_);
+  coffset_ += n;
+}
+
+void BgzfWriter::close()
+{
+  if (!fh_) return;
+  flush_block();
+  const bool ok = std::fwrite(EOF_BLOCK, 1, sizeof EOF_BLOCK, fh_) == sizeof EOF_BLOCK;
+  const bool closed = std::fclose(fh_) == 0;
+  fh_ = nullptr;
+  if (!ok || !closed) throw std::runtime_error("Write error on " + path_);
+}
+
+/* -------------------------------------------------------------------------
+   Reader
+   --------------------------------------------------------------------- */
+BgzfReader::BgzfReader(const std::string& path) : path_(path)
+{
+  fh_ = std::fopen(path.c_str(), "rb");
+  if (!fh_) throw std::runtime_error("Cannot open " + path);
+  in_.resize(BLOCK_MAX);
+}
+
+BgzfReader::~BgzfReader()
+{
+  if (fh_) std::fclose(fh_);
+}
+
+bool BgzfReader::load_block()
+{
+  block_.clear();
+  pos_ = 0;
+  while (block_.empty()) {          // skip empty blocks (EOF marker)
+    coffset_ = next_ = static_cast<std::uint64_t>(ftello(fh_));
+    unsigned char* h = in_.data();
+    const std::size_t got = std::fread(h, 1, HEADER_SZ, fh_);
+    if (got == 0) return false;
+    if (got != HEADER_SZ || !header_ok(h))
+      throw std::runtime_error("Not a BGZF block in " + path_);
+    const std::size_t bsize = get_le16(h + 16) + 1;
+    if (bsize < HEADER_SZ + FOOTER_SZ ||
+        std::fread(h + HEADER_SZ, 1, bsize - HEADER_SZ, fh_) != bsize - HEADER_SZ)
+      throw std::runtime_error("Truncated BGZF block in " + path_);
+    next_ = coffset_ + bsize;
+
+    const std::uint32_t isize = get_le32(h + bsize - 4);
+    block_.resize(isize);
+    if (!isize) continue;
+
+    z_stream zs{};
+    if (inflateInit2(&zs, -15) != Z_OK)
+      throw std::runtime_error("inflateInit2 failed for " + path_);
+    zs.next_in   = h + HEADER_SZ;
+    zs.avail_in  = static_cast<uInt>(bsize - HEADER_SZ - FOOTER_SZ);
+    zs.next_out  = reinterpret_cast<Bytef*>(block_.data());
+    zs.avail_out = isize;
+    const int rc = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (rc != Z_STREAM_END || zs.total_out != isize)
+      throw std::runtime_error("Corrupt BGZF block in " + path_);
+  }
+  return true;
+}
+
+void BgzfReader::seek(std::uint64_t voffset)
+{
+  if (fseeko(fh_, static_cast<off_t>(voffset >> 16), SEEK_SET) != 0)
+    throw std::runtime_error("Seek failed in " + path_);
+  if (!load_block()) { block_.clear(); pos_ = 0; next_ = voffset >> 16; return; }
+  pos_ = static_cast<std::size_t>(voffset & 0xffff);
+  if (pos_ > block_.size()) throw std::runtime_error("Bad virtual offset in " + path_);
+}
+
+std::size_t BgzfReader::read(void* data, std::size_t n)
+{
+  char* out = static_cast<char*>(data);
+  std::size_t done = 0;
+  while (done < n) {
+    if (pos_ == block_.size() && !load_block()) break;
+    const std::size_t k = std::min(n - done, block_.size() - pos_);
+    std::memcpy(out + done, block_.data() + pos_, k);
+    pos_ += k; done += k;
+  }
+  return done;
+}
+
+bool BgzfReader::getline(std::string& line)
+{
+  line.clear();
+  bool any = false;
+  while (true) {
+    if (pos_ == block_.size() && !load_block()) return any;
+    any = true;
+    const char* beg = block_.data() + pos_;
+    const char* end = block_.data() + block_.size();
+    const char* nl  = static_cast<const char*>(std::memchr(beg, '\n', end - beg));
+    if (nl) {
+      line.append(beg, nl);
+      pos_ += static_cast<std::size_t>(nl - beg) + 1;
+      return true;
+    }
+    line.append(beg, end);
+    pos_ = block_.size();
+  }
+}
+
+/* --------------------------------------------------------------------- */
+bool is_bgzf(const std::string& path)
+{
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) return false;
+  unsigned char h[HEADER_SZ];
+  const bool ok = std::fread(h, 1, HEADER_SZ, fh) == HEADER_SZ && header_ok(h);
+  std::fclose(fh);
+  return ok;
+}
+
+std::vector<BgzfSplit> bgzf_splits(const std::string& path, std::uint64_t spacing)
+{
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) throw std::runtime_error("Cannot open " + path);
+  std::vector<BgzfSplit> out;
+  unsigned char h[HEADER_SZ];
+  std::uint64_t pos = 0, prev = 0, prevSize = 0, last = 0;
+  bool ok = true;
+
+  // walk the block headers only; the data is never read
+  while (fseeko(fh, static_cast<off_t>(pos), SEEK_SET) == 0 &&
+         std::fread(h, 1, HEADER_SZ, fh) == HEADER_SZ) {
+    if (!header_ok(h)) { ok = false; break; }
+    const std::uint64_t bsize = get_le16(h + 16) + 1;
+    if (pos > 0 && pos - last >= spacing && bsize != sizeof EOF_BLOCK) {
+      // ISIZE of the previous block: its last byte is at ISIZE - 1
+      unsigned char isz[4];
+      if (fseeko(fh, static_cast<off_t>(prev + prevSize - 4), SEEK_SET) != 0 ||
+          std::fread(isz, 1, 4, fh) != 4) { ok = false; break; }
+      const std::uint32_t n = get_le32(isz);
+      if (n > 0) {
+        out.push_back({pos << 16, (prev << 16) | (n - 1)});
+        last = pos;
+      }
+    }
+    prev = pos; prevSize = bsize;
+    pos += bsize;
+  }
+  std::fclose(fh);
+  if (!ok) throw std::runtime_error("Not a BGZF block in " + path);
+  return out;
+}
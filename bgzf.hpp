@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+------------------------------------------------------------------------------
+ Minimal BGZF (blocked gzip, as used by htslib) writer and reader.
+ A BGZF file is a series of independent gzip members of at most 64 KiB each,
+ so it stays readable by zcat / gzopen, while a "virtual offset"
+   (compressed offset of the block << 16) | offset inside the block
+ lets a reader seek straight to any byte of the uncompressed stream.
+------------------------------------------------------------------------------
+*/
+
+class BgzfWriter {
+public:
+  explicit BgzfWriter(const std::string& path, int level = 6);
+  ~BgzfWriter();
+  BgzfWriter(const BgzfWriter&)            = delete;
+  BgzfWriter& operator=(const BgzfWriter&) = delete;
+
+  void write(const void* data, std::size_t n);
+
+  // virtual offset of the next byte to be written
+  std::uint64_t tell() const { return (coffset_ << 16) | buf_.size(); }
+
+  // end the current block now; returns the compressed offset of the next one
+  std::uint64_t end_block() { flush_block(); return coffset_; }
+
+  // append whole BGZF blocks taken from another file (after end_block())
+  void write_raw(const void* blocks, std::size_t n);
+
+  // flush, append the EOF marker block and close; throws on I/O errors
+  void close();
+
+private:
+  void flush_block();
+
+  std::string       path_;
+  std::FILE*        fh_ = nullptr;
+  int               level_;
+  std::uint64_t     coffset_ = 0;   // compressed bytes written so far
+  std::vector<char> buf_;           // pending uncompressed block
+  std::vector<unsigned char> out_;  // scratch for one compressed block
+};
+
+class BgzfReader {
+public:
+  explicit BgzfReader(const std::string& path);
+  ~BgzfReader();
+  BgzfReader(const BgzfReader&)            = delete;
+  BgzfReader& operator=(const BgzfReader&) = delete;
+
+  void seek(std::uint64_t voffset);
+
+  // read up to n bytes; returns the number read (0 at end of file)
+  std::size_t read(void* data, std::size_t n);
+
+  // read one line (newline stripped); false at end of file
+  bool getline(std::string& line);
+
+  // virtual offset of the next byte read; at the end of a block this is
+  // the start of the next one, matching BgzfWriter::tell()
+  std::uint64_t tell() const
+  {
+    return pos_ < block_.size() ? (coffset_ << 16) | pos_ : next_ << 16;
+  }
+
+private:
+  bool load_block();   // read + inflate the block at the current file pos
+
+  std::string       path_;
+  std::FILE*        fh_ = nullptr;
+  std::vector<char> block_;         // inflated contents of the current block
+  std::size_t       pos_ = 0;       // read position inside block_
+  std::uint64_t     coffset_ = 0;   // compressed offset of the current block
+  std::uint64_t     next_    = 0;   // ... and of the one after it
+  std::vector<unsigned char> in_;
+};
+
+// true if `path` starts with a BGZF block header
+bool is_bgzf(const std::string& path);
+
+// Block starts of `path` where a reader may begin, roughly `spacing`
+// compressed bytes apart (the first block is never listed), each with the
+// virtual offset of the byte just before it, which tells whether the block
+// starts a fresh line.
+struct BgzfSplit {
+  std::uint64_t voffset;    // start of the block
+  std::uint64_t prevByte;   // last byte of the previous block
+};
+std::vector<BgzfSplit> bgzf_splits(const std::string& path, std::uint64_t spacing);
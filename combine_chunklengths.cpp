@@ -1,36 +1,30 @@
 #include <algorithm>
-#include <chrono>      // timestamps for logging
+#include <cstdint>
 #include <cstdlib>
-#include <fstream>
-#include <iomanip>
+#include <exception>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
-#include <zlib.h>
-#include <cstring>     // std::memmove, std::strlen
-#include <cfloat>      // FLT_MAX
-#include <cerrno>
-#include <cctype>      // std::isspace
+
+#include "combine_core.hpp"
+#include "input_stream.hpp"
+#include "matrix_io.hpp"
 
 /*
 ------------------------------------------------------------------------------
  Fast, memory-efficient combiner for ChromoPainter / pbwt / SparsePainter
- Now with timestamped progress logging and unbuffered stdout.
- - Reads arbitrarily long header lines safely (gzgets loop)
- - Splits on ANY whitespace (not just spaces)
- - Safer tokenization for streaming row parsing
+ chunk-length outputs: sums per-chromosome matrices into one, with
+ timestamped progress logging on unbuffered stdout.  Besides the combine
+ itself there are the query, index, merge-bands and reduce subcommands.
+ Inputs are read through InputStream (input_stream.hpp), the parsing and
+ accumulation live in combine_core.cpp and the writers in matrix_io.cpp;
+ this file is the CLI.
 ------------------------------------------------------------------------------
 */
 
-#define LOG(msg)                                                             \
-  do {                                                                       \
-    using clk = std::chrono::system_clock;                                   \
-    auto  now = clk::to_time_t(clk::now());                                  \
-    std::cout << std::put_time(std::localtime(&now), "%F %T") << "  " << msg \
-              << std::endl;                                                  \
-  } while (0)
-
 /* --------------------------------------------------------------------- */
 // simple CSV splitter for small strings like "1,2,3"
 static std::vector<std::string> split_csv(const std::string& s, char delimiter)
@@ -47,322 +41,419 @@ static std::vector<std::string> split_csv(const std::string& s, char delimiter)
   return tokens;
 }
 
-// split on any whitespace
-static std::vector<std::string> split_ws(const std::string& s)
-{
-  std::istringstream iss(s);
-  std::vector<std::string> out;
-  for (std::string tok; iss >> tok; ) out.push_back(tok);
-  return out;
-}
-
 void usage(const char* prog)
 {
   std::cerr << "Usage: " << prog
-            << " -p <pre_chr> -a <post_chr> -c <chrs> -o <output> -t <type>\n";
+            << " (-p <pre_chr> -a <post_chr> -c <chrs> | --inputs <manifest> |"
+               " --glob <pattern> | -i <input>)...\n"
+               "       -o <output> -t <type> [-j <threads>]\n"
+               "       [--out-format text|npy|raw] [--bgzf] [--check-only]\n"
+               "       [--align] [--master-ids <file>] [--union] [--mean]\n"
+               "       [--hugepages off|thp|explicit] [--numa] [--bands <n>]\n"
+               "       [--split-mb <MiB>] [--prefetch-mb <MiB>] [--lockstep] [--jackknife]\n"
+               "       [--group <name>=<chr>,<chr>,...]...\n"
+               "       [--reader sync|pread|uring] [--row-range <start>:<end> | --shard <i>/<n>]\n"
+            << "       " << prog << " query <combined output> <row name>...\n"
+            << "       " << prog << " merge-bands -o <output> <band output>...\n"
+            << "       " << prog << " reduce -o <output> [-j <threads>] [--out-format text|npy|raw]\n"
+               "       [--bgzf] [--hugepages off|thp|explicit] <combined output>...\n"
+            << "       " << prog << " index [-j <threads>] [--index-mb <MiB>] <input.gz>...\n";
 }
 
-/* -------------------------------------------------------------------------
-   SparsePainter row discovery (rectangular matrices)
-   --------------------------------------------------------------------- */
-static std::size_t collect_row_names_sparsepainter(
-    const std::string        &filename,
-    int                       removeIndex,
-    std::vector<std::string> &rowNames,
-    char                     *lineBuf,
-    const std::size_t         lineBufSz)
+/* --------------------------------------------------------------------- */
+static int run_query(int argc, char* argv[])
 {
-  gzFile fh = gzopen(filename.c_str(), "rb");
-  if (!fh) {
-    std::cerr << "[collect] could not open " << filename << '\n';
-    std::exit(1);
+  if (argc < 4) { usage(argv[0]); return 1; }
+  std::vector<std::string> names(argv + 3, argv + argc);
+  try {
+    query_rows(argv[2], names, std::cout);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
   }
+  return 0;
+}
 
-  // read + discard header (could be very long)
-  std::string header;
-  while (true) {
-    char* got = gzgets(fh, lineBuf, lineBufSz);
-    if (!got) { std::cerr << "[collect] empty file " << filename << '\n'; std::exit(1); }
-    header.append(got);
-    size_t len = std::strlen(got);
-    if (len && got[len - 1] == '\n') break;
+/* --------------------------------------------------------------------- */
+// build the .zidx checkpoint index of plain gzip inputs, for --split-mb
+static int run_index(int argc, char* argv[])
+{
+  std::cout.setf(std::ios::unitbuf);
+  unsigned threads = 1;
+  std::uint64_t spacing = std::uint64_t{16} << 20;
+  std::vector<InputFile> files;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j" || arg == "--threads") && i + 1 < argc)
+      threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+    else if (arg == "--index-mb" && i + 1 < argc)
+      spacing = static_cast<std::uint64_t>(std::max(0.0625, std::atof(argv[++i])) * (1 << 20));
+    else
+      files.push_back({arg});
   }
+  if (files.empty()) { usage(argv[0]); return 1; }
+  try {
+    index_inputs(files, threads, spacing);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
 
-  rowNames.clear();
-  rowNames.reserve(4'000'000);   // heuristic
-
-  // read rows; extract the token at removeIndex (i.e., the ID column)
-  std::string spill; spill.reserve(1024);
-  constexpr std::size_t CHUNK = 32 * 1024 * 1024;
-  std::vector<char> chunk(CHUNK);
-
-  auto skip_ws = [](const char*& p, const char* end) {
-    while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
-  };
-
-  while (true) {
-    int got = gzread(fh, chunk.data(), CHUNK);
-    if (got <= 0) break;
-    const char* data      = chunk.data();
-    const char* endChunk  = data + got;
-    const char* lineStart = data;
-
-    for (const char* p = data; p < endChunk; ++p) {
-      if (*p == '\n') {
-        spill.append(lineStart, p - lineStart);
-
-        const char* cur = spill.data();
-        const char* lineEnd = cur + spill.size();
-        int col = 0;
-
-        // walk tokens by whitespace
-        while (true) {
-          skip_ws(cur, lineEnd);
-          if (cur >= lineEnd) break;
-          const char* tokBeg = cur;
-          while (cur < lineEnd && !std::isspace(static_cast<unsigned char>(*cur))) ++cur;
-
-          if (col == removeIndex) {
-            rowNames.emplace_back(tokBeg, static_cast<std::size_t>(cur - tokBeg));
-            break; // we only needed the ID column
-          }
-          ++col;
-        }
+/* --------------------------------------------------------------------- */
+// join the outputs of --row-range / --shard runs into the full result
+static int run_merge_bands(int argc, char* argv[])
+{
+  std::cout.setf(std::ios::unitbuf);
+  std::string output;
+  std::vector<std::string> bands;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc) output = argv[++i];
+    else bands.push_back(arg);
+  }
+  if (output.empty() || bands.empty()) { usage(argv[0]); return 1; }
+  try {
+    LOG("Merging " << bands.size() << " row bands into " << output);
+    merge_bands(bands, output);
+    LOG("Done");
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
 
-        spill.clear();
-        lineStart = p + 1;
+/* --------------------------------------------------------------------- */
+// sum the outputs of earlier runs (same rows and columns) into one
+static int run_reduce(int argc, char* argv[])
+{
+  std::cout.setf(std::ios::unitbuf);
+  std::string output, outFormat = "text";
+  CombineOptions opts;
+  WriteOptions   wopts;
+  std::vector<std::string> inputs;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc) output = argv[++i];
+    else if ((arg == "-j" || arg == "--threads") && i + 1 < argc)
+      opts.threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+    else if (arg == "--out-format" && i + 1 < argc) outFormat = argv[++i];
+    else if (arg == "--bgzf") wopts.bgzf = true;
+    else if (arg == "--hugepages" && i + 1 < argc) {
+      if (!parse_huge_pages(argv[++i], opts.hugePages)) {
+        std::cerr << "--hugepages must be off, thp, or explicit\n";
+        return 1;
       }
     }
-    if (lineStart < endChunk) spill.append(lineStart, endChunk - lineStart);
+    else inputs.push_back(arg);
   }
-
-  gzclose(fh);
-  return rowNames.size();
+  if (output.empty() || inputs.empty()) { usage(argv[0]); return 1; }
+  wopts.threads = opts.threads;
+  wopts.zstd    = output.size() > 4 && output.compare(output.size() - 4, 4, ".zst") == 0;
+  if (wopts.zstd && wopts.bgzf) {
+    std::cerr << "--bgzf can't be used with a .zst output\n";
+    return 1;
+  }
+  if (!parse_out_format(outFormat, wopts.format)) {
+    std::cerr << "--out-format must be text, npy, or raw\n";
+    return 1;
+  }
+  try {
+    LOG("Reducing " << inputs.size() << " combined outputs into " << output
+        << "  threads=" << opts.threads);
+    CombinedMatrix m = reduce_outputs(inputs, opts);
+    LOG("Writing " << outFormat << " output to " << output);
+    write_matrix(output, m, wopts);
+    LOG("Done  (" << m.nrows << "×" << m.ncols << ")");
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
 }
 
 /* --------------------------------------------------------------------- */
-inline bool next_token(const char *&p, const char *end)
+// "<name>.<tag>.<extensions>" for output "<name>.<extensions>"
+static std::string beside(const std::string& output, const std::string& tag)
+{
+  const auto slash = output.find_last_of('/');
+  const auto dot   = output.find('.', slash == std::string::npos ? 0 : slash + 1);
+  return dot == std::string::npos ? output + "." + tag
+                                  : output.substr(0, dot) + "." + tag + output.substr(dot);
+}
+
+// --jackknife: the result without input f goes next to the main output as
+// "<name>.minus_<label>.<extensions>", written as soon as it is complete
+class LocoWriter : public LeaveOneOutput {
+public:
+  LocoWriter(const std::string& output, const std::vector<std::string>& labels,
+             const WriteOptions& wopts, bool mean)
+    : wopts_(wopts), mean_(mean)
+  {
+    for (const auto& l : labels) paths_.push_back(beside(output, "minus_" + l));
+  }
+
+  void write(std::size_t f, CombinedMatrix& m) override
+  {
+    if (mean_) mean_over_present(m);
+    write_matrix(paths_[f], m, wopts_);
+    LOG("Wrote " << paths_[f]);
+  }
+
+private:
+  std::vector<std::string> paths_;
+  WriteOptions             wopts_;
+  bool                     mean_;
+};
+
+// what names each input in --jackknife outputs and --group lists: the -c
+// value (files[0 .. chrs.size()) come from -c), else the file name up to its
+// first '.'.  A name that is empty or shared by two inputs is an error, so a
+// --group list or a minus_<label> output never silently means another input.
+static std::vector<std::string> input_labels(const std::vector<std::string>& chrs,
+                                            const std::vector<InputFile>& files)
 {
-  while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
-  return p < end;
+  std::vector<std::string> labels(chrs);
+  for (std::size_t f = chrs.size(); f < files.size(); ++f) {
+    const std::string& path = files[f].path;
+    const auto slash = path.find_last_of('/');
+    const std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    labels.push_back(base.substr(0, base.find('.')));
+  }
+  for (std::size_t f = 0; f < labels.size(); ++f) {
+    if (labels[f].empty())
+      throw std::runtime_error("Input " + files[f].path + " has an empty name; "
+                               "rename it so it has one before its first '.'");
+    for (std::size_t g = 0; g < f; ++g)
+      if (labels[g] == labels[f])
+        throw std::runtime_error("Inputs " + files[g].path + " and " + files[f].path +
+                                 " are both named " + labels[f] +
+                                 "; --jackknife and --group need unique input names");
+  }
+  return labels;
 }
 
 /* --------------------------------------------------------------------- */
 int main(int argc, char* argv[])
 {
+  if (argc > 1 && std::string(argv[1]) == "query") return run_query(argc, argv);
+  if (argc > 1 && std::string(argv[1]) == "index") return run_index(argc, argv);
+  if (argc > 1 && std::string(argv[1]) == "merge-bands") return run_merge_bands(argc, argv);
+  if (argc > 1 && std::string(argv[1]) == "reduce") return run_reduce(argc, argv);
+
   /* ---- unbuffered stdout so every log line is immediate --------------- */
   std::cout.setf(std::ios::unitbuf);
 
   LOG("starting combine_chunklengths");
 
   /* ---- command-line parsing ------------------------------------------ */
-  std::string pre_chr, post_chr, chrsStr, output, prog;
+  std::string pre_chr, post_chr, chrsStr, output, prog, outFormat = "text";
+  std::vector<InputFile> listed;   // from --inputs / --glob, in order given
+  unsigned threads = 1;
+  CombineOptions opts;
+  WriteOptions   wopts;
+  bool checkOnly = false, mean = false, lockstep = false, jackknife = false;
+  std::vector<std::pair<std::string, std::string>> groupArgs;   // name, members
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
+    if (arg == "--bgzf")       { wopts.bgzf = true; continue; }
+    if (arg == "--check-only") { checkOnly  = true; continue; }
+    if (arg == "--align")      { opts.align = true; continue; }
+    if (arg == "--union")      { opts.unionIds = true; continue; }
+    if (arg == "--mean")       { mean = true; continue; }
+    if (arg == "--lockstep")   { lockstep = true; continue; }
+    if (arg == "--jackknife")  { jackknife = true; continue; }
+    if (arg == "--numa")       { opts.numa = true; continue; }
+    if (i + 1 >= argc) { usage(argv[0]); return 1; }
     if ((arg == "-p") || (arg == "--pre_chr"))        pre_chr = argv[++i];
     else if ((arg == "-a") || (arg == "--post_chr"))  post_chr = argv[++i];
     else if ((arg == "-c") || (arg == "--chrs"))      chrsStr = argv[++i];
     else if ((arg == "-o") || (arg == "--output"))    output  = argv[++i];
     else if ((arg == "-t") || (arg == "--type"))      prog    = argv[++i];
+    else if ((arg == "-j") || (arg == "--threads"))
+      threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+    else if (arg == "--out-format")                   outFormat = argv[++i];
+    else if (arg == "--master-ids")                   opts.masterIds = argv[++i];
+    else if (arg == "--split-mb")
+      opts.splitBytes = static_cast<std::uint64_t>(std::max(0.0, std::atof(argv[++i])) * (1 << 20));
+    else if (arg == "--prefetch-mb")
+      opts.prefetchBytes = static_cast<std::uint64_t>(std::max(0.0, std::atof(argv[++i])) * (1 << 20));
+    else if (arg == "--bands")
+      opts.bands = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+    else if (arg == "--reader") {
+      ReadBackend backend;
+      if (!parse_read_backend(argv[++i], backend)) {
+        std::cerr << "--reader must be sync, pread, or uring\n";
+        return 1;
+      }
+      set_read_backend(backend);
+    }
+    else if (arg == "--row-range" || arg == "--shard") {
+      const bool range = arg == "--row-range";
+      if (!(range ? parse_row_range(argv[++i], opts.rows) : parse_shard(argv[++i], opts.rows))) {
+        std::cerr << (range ? "--row-range must be <start>:<end> with start < end\n"
+                            : "--shard must be <i>/<n> with 0 <= i < n\n");
+        return 1;
+      }
+    }
+    else if (arg == "--hugepages") {
+      if (!parse_huge_pages(argv[++i], opts.hugePages)) {
+        std::cerr << "--hugepages must be off, thp, or explicit\n";
+        return 1;
+      }
+    }
+    else if (arg == "--group") {
+      const std::string g = argv[++i];
+      const auto eq = g.find('=');
+      const std::string name = g.substr(0, eq);
+      if (eq == std::string::npos || name.empty() ||
+          name.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                                 "0123456789_-") != std::string::npos) {
+        std::cerr << "--group must be <name>=<chr>,<chr>,... (name: letters, digits, _ or -)\n";
+        return 1;
+      }
+      groupArgs.emplace_back(name, g.substr(eq + 1));
+    }
+    else if ((arg == "-i") || (arg == "--input"))     listed.push_back({argv[++i]});
+    else if (arg == "--inputs" || arg == "--glob") {
+      try {
+        auto more = arg == "--inputs" ? read_manifest(argv[++i]) : expand_glob(argv[++i]);
+        listed.insert(listed.end(), more.begin(), more.end());
+      } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+      }
+    }
     else { usage(argv[0]); return 1; }
   }
 
-  if (prog != "pbwt" && prog != "chromopainter" && prog != "SparsePainter") {
+  if (!parse_input_type(prog, opts.type)) {
     std::cerr << "--type must be pbwt, chromopainter, or SparsePainter\n";
     return 1;
   }
+  opts.threads = threads;
+  wopts.threads = threads;
+  wopts.zstd    = output.size() > 4 && output.compare(output.size() - 4, 4, ".zst") == 0;
+  if (wopts.zstd && wopts.bgzf) {
+    std::cerr << "--bgzf can't be used with a .zst output\n";
+    return 1;
+  }
+
+  if (!parse_out_format(outFormat, wopts.format)) {
+    std::cerr << "--out-format must be text, npy, or raw\n";
+    return 1;
+  }
 
   std::vector<std::string> chrs = split_csv(chrsStr, ',');
-  if (chrs.empty()) {
+  if (chrs.empty() && listed.empty()) {
     std::cerr << "No chromosomes specified\n";
     return 1;
   }
 
   LOG("pre_chr=" << pre_chr << "  post_chr=" << post_chr
       << "  chrs=" << chrsStr << "  output=" << output
-      << "  type=" << prog);
+      << "  type=" << prog << "  threads=" << threads
+      << "  out-format=" << outFormat << (wopts.bgzf ? " (bgzf)" : ""));
 
-  constexpr std::size_t LINE_BUF = 1 << 20;   // 1 MiB per gzgets chunk
-  char* lineBuf = new char[LINE_BUF];
-
-  /* ---- read header of first chromosome (robustly) --------------------- */
-  std::string firstFile = pre_chr + chrs[0] + post_chr;
-  gzFile gzfirst = gzopen(firstFile.c_str(), "rb");
-  if (!gzfirst) { std::cerr << "Cannot open " << firstFile << '\n'; return 1; }
-
-  std::string headerLine;
-  headerLine.reserve(8 << 20); // 8 MiB initial guess
-  while (true) {
-    char* got = gzgets(gzfirst, lineBuf, LINE_BUF);
-    if (!got) { std::cerr << "Header read error\n"; return 1; }
-    headerLine.append(got);
-    size_t len = std::strlen(got);
-    if (len && got[len - 1] == '\n') {
-      // strip trailing newline
-      if (!headerLine.empty() && headerLine.back() == '\n') headerLine.pop_back();
-      break;
-    }
+  if (jackknife && lockstep) {
+    std::cerr << "--jackknife can't be used with --lockstep\n";
+    return 1;
   }
-
-  const auto headers = split_ws(headerLine);
-
-  int removeIndex = -1;
-  for (std::size_t i = 0; i < headers.size(); ++i) {
-    if ((prog == "pbwt"          && headers[i] == "RECIPIENT") ||
-        (prog == "chromopainter" && headers[i] == "Recipient") ||
-        (prog == "SparsePainter" && headers[i] == "indnames")) {
-      removeIndex = static_cast<int>(i);
-      break;
-    }
+  if (jackknife && chrs.size() + listed.size() < 2) {
+    std::cerr << "--jackknife needs at least two inputs\n";
+    return 1;
   }
-  if (removeIndex == -1) {
-    std::cerr << "Could not locate ID column in header\n";
+  if (!groupArgs.empty() && lockstep) {
+    std::cerr << "--group can't be used with --lockstep\n";
     return 1;
   }
-
-  std::vector<std::string> colNames;
-  std::vector<int>         colIndices;
-  colNames.reserve(headers.size() ? headers.size() - 1 : 0);
-  for (std::size_t i = 0; i < headers.size(); ++i) {
-    if (static_cast<int>(i) != removeIndex) {
-      colNames  .push_back(headers[i]);
-      colIndices.push_back(static_cast<int>(i));
+  std::vector<InputFile> files;
+  files.reserve(chrs.size() + listed.size());
+  for (const auto& c : chrs) files.push_back({pre_chr + c + post_chr});
+  files.insert(files.end(), listed.begin(), listed.end());
+
+  std::vector<std::string> labels;
+  if (jackknife || !groupArgs.empty()) {
+    try {
+      labels = input_labels(chrs, files);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << '\n';
+      return 1;
     }
   }
-  const std::size_t ncols = colNames.size();
-
-  /* ---- row discovery -------------------------------------------------- */
-  std::vector<std::string> rowNames;
-  std::size_t nrows = 0;
-  if (prog == "SparsePainter") {
-    gzclose(gzfirst);
-    nrows = collect_row_names_sparsepainter(firstFile, removeIndex,
-                                            rowNames, lineBuf, LINE_BUF);
-  } else {
-    rowNames = colNames;  // square matrix for pbwt / chromopainter
-    nrows    = ncols;
-    gzrewind(gzfirst);
+  for (const auto& g : groupArgs) {
+    std::vector<std::size_t> members;
+    for (const auto& c : split_csv(g.second, ',')) {
+      const auto it = std::find(labels.begin(), labels.end(), c);
+      if (it == labels.end()) {
+        std::cerr << "--group " << g.first << ": no input " << c << '\n';
+        return 1;
+      }
+      const auto f = static_cast<std::size_t>(it - labels.begin());
+      if (std::find(members.begin(), members.end(), f) != members.end()) {
+        std::cerr << "--group " << g.first << ": " << c << " is listed twice\n";
+        return 1;
+      }
+      members.push_back(f);
+    }
+    if (members.empty()) {
+      std::cerr << "--group " << g.first << " has no inputs\n";
+      return 1;
+    }
+    for (const auto& other : groupArgs)
+      if (&other != &g && other.first == g.first) {
+        std::cerr << "--group " << g.first << " is given twice\n";
+        return 1;
+      }
+    opts.groups.push_back(std::move(members));
   }
+  std::unique_ptr<LocoWriter> loco;
+  if (jackknife) loco = std::make_unique<LocoWriter>(output, labels, wopts, mean);
 
-  LOG("matrix size will be " << nrows << " rows × " << ncols << " cols");
-
-  // WARNING: nrows * ncols could be huge. Consider tiling if needed.
-  std::vector<float> total;
   try {
-    total.assign(nrows * ncols, 0.0f);
-  } catch (const std::bad_alloc&) {
-    std::cerr << "Memory allocation failed for matrix of size "
-              << nrows << " x " << ncols << '\n';
-    return 1;
-  }
-
-  /* ---- streaming decode helper --------------------------------------- */
-  constexpr std::size_t CHUNK = 32 * 1024 * 1024;   // 32 MiB
-  std::vector<char> chunk(CHUNK);
-
-  auto processFile = [&](const std::string& fname)
-  {
-    LOG("Processing " << fname);
-    gzFile gzf = gzopen(fname.c_str(), "rb");
-    if (!gzf) { std::cerr << "Cannot open " << fname << '\n'; std::exit(1); }
-
-    // skip header line (robustly)
-    std::string dummyHeader;
-    while (true) {
-      char* got = gzgets(gzf, lineBuf, LINE_BUF);
-      if (!got) { std::cerr << "Header read error in " << fname << '\n'; std::exit(1); }
-      dummyHeader.append(got);
-      size_t len = std::strlen(got);
-      if (len && got[len - 1] == '\n') break;
+    if (checkOnly) {
+      stat_inputs(files);
+      validate_headers(files, opts.type, threads, header_match(opts));
+      return 0;
     }
 
-    std::string spill; spill.reserve(1024);
-    std::size_t row = 0;
-
-    while (true) {
-      int got = gzread(gzf, chunk.data(), CHUNK);
-      if (got <= 0) break;
-      const char* data      = chunk.data();
-      const char* endChunk  = data + got;
-      const char* lineStart = data;
-
-      for (const char* p = data; p < endChunk; ++p) {
-        if (*p == '\n') {
-          spill.append(lineStart, p - lineStart);
-
-          const char* cur = spill.data();
-          const char* lineEnd = cur + spill.size();
-          int col = 0, outCol = 0;
-
-          while (next_token(cur, lineEnd)) {
-            const char* tokBeg = cur;
-            while (cur < lineEnd && !std::isspace(static_cast<unsigned char>(*cur))) ++cur;
-
-            if (col != removeIndex) {
-              errno = 0;
-              float v = strtof(tokBeg, nullptr);
-              if (errno == ERANGE) v = (v < 0 ? -FLT_MAX : FLT_MAX);
-              if (row < nrows && static_cast<std::size_t>(outCol) < ncols) {
-                total[row * ncols + outCol] += v;
-              }
-              ++outCol;
-            }
-            ++col;
-          }
-          ++row;
-          spill.clear();
-          lineStart = p + 1;
-        }
-      }
-      if (lineStart < endChunk) spill.append(lineStart, endChunk - lineStart);
+    const std::string writing =
+        wopts.bgzf ? "BGZF " + outFormat :
+        wopts.zstd ? "zstd " + outFormat :
+        wopts.format == OutFormat::Text ? std::string("gzipped") : outFormat;
+    if (lockstep) {
+      LOG("Writing " << writing << " output to " << output << " as rows are merged");
+      MatrixWriter writer(output, wopts);
+      combine_lockstep(std::move(files), opts, writer, mean);
+      LOG("Done");
+      return 0;
     }
 
-    if (row != nrows) {
-      std::cerr << "Warning: " << fname << " has " << row
-                << " rows (expected " << nrows << ")\n";
+    if (loco) LOG("Writing " << writing << " leave-one-out outputs as they complete");
+    std::vector<CombinedMatrix> groups;
+    CombinedMatrix m = combine_files(std::move(files), opts, loco.get(), &groups);
+    LOG("All chromosomes processed");
+    if (mean) {
+      mean_over_present(m);
+      for (auto& g : groups) mean_over_present(g);
+      LOG("Divided by the number of inputs present per cell");
     }
-    gzclose(gzf);
-    LOG("Finished " << fname << "  rows=" << row);
-  };
-
-  /* ---- pass over all chromosomes ------------------------------------- */
-  if (prog != "SparsePainter") {
-    // resume at beginning for first file
-    processFile(firstFile);
-  } else {
-    // we closed gzfirst already in SparsePainter branch; reopen
-    processFile(firstFile);
-  }
-  for (std::size_t i = 1; i < chrs.size(); ++i)
-    processFile(pre_chr + chrs[i] + post_chr);
-
-  LOG("All chromosomes processed");
 
-  /* ---- write result --------------------------------------------------- */
-  LOG("Writing gzipped output to " << output);
-
-  gzFile out = gzopen(output.c_str(), "wb");
-  if (!out) { std::cerr << "Cannot create output " << output << '\n'; return 1; }
-
-  const char* idLabel =
-      (prog == "pbwt") ? "RECIPIENT" :
-      (prog == "chromopainter") ? "Recipient" :
-      "indnames";
-
-  gzprintf(out, "%s", idLabel);
-  for (const auto& c : colNames) gzprintf(out, " %s", c.c_str());
-  gzprintf(out, "\n");
+    /* ---- write result ------------------------------------------------- */
+    LOG("Writing " << writing << " output to " << output);
+    write_matrix(output, m, wopts);
+    for (std::size_t g = 0; g < groups.size(); ++g) {
+      const std::string path = beside(output, groupArgs[g].first);
+      LOG("Writing group " << groupArgs[g].first << " to " << path);
+      write_matrix(path, groups[g], wopts);
+    }
 
-  for (std::size_t r = 0; r < nrows; ++r) {
-    gzprintf(out, "%s", rowNames[r].c_str());
-    for (std::size_t c = 0; c < ncols; ++c)
-      gzprintf(out, " %.6f", total[r * ncols + c]);
-    gzprintf(out, "\n");
+    LOG("Done  (" << m.nrows << "×" << m.ncols << ")");
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+    return 1;
   }
-  gzclose(out);
-
-  LOG("Done  (" << nrows << "×" << ncols << ")");
-  delete[] lineBuf;
   return 0;
 }
-
@@ -0,0 +1,1991 @@
+#include "combine_core.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cctype>      // std::isspace
+#include <cerrno>
+#include <cfloat>      // FLT_MAX
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>     // std::strlen
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <unordered_map>
+
+#include "bgzf.hpp"
+#include "gz_index.hpp"
+#include "helper_pool.hpp"
+#include "input_stream.hpp"
+#include "matrix_io.hpp"
+#include "prefetch.hpp"
+#include "row_kernels.hpp"
+#include "spsc_queue.hpp"
+#include "work_queue.hpp"
+
+/* --------------------------------------------------------------------- */
+bool parse_input_type(const std::string& s, InputType& type)
+{
+  if (s == "pbwt")          { type = InputType::Pbwt;          return true; }
+  if (s == "chromopainter") { type = InputType::ChromoPainter; return true; }
+  if (s == "SparsePainter") { type = InputType::SparsePainter; return true; }
+  return false;
+}
+
+const char* id_label(InputType type)
+{
+  switch (type) {
+    case InputType::Pbwt:          return "RECIPIENT";
+    case InputType::ChromoPainter: return "Recipient";
+    case InputType::SparsePainter: return "indnames";
+  }
+  return "";
+}
+
+/* --------------------------------------------------------------------- */
+// all of `s` as a non-negative number
+static bool parse_count(const std::string& s, std::size_t& n)
+{
+  if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos) return false;
+  n = static_cast<std::size_t>(std::strtoull(s.c_str(), nullptr, 10));
+  return true;
+}
+
+bool parse_row_range(const std::string& s, RowRange& r)
+{
+  const auto colon = s.find(':');
+  if (colon == std::string::npos) return false;
+  const std::string a = s.substr(0, colon), b = s.substr(colon + 1);
+  RowRange out;
+  if (!a.empty() && !parse_count(a, out.begin)) return false;
+  if (!b.empty() && !parse_count(b, out.end))   return false;
+  if (out.begin >= out.end) return false;
+  r = out;
+  return true;
+}
+
+bool parse_shard(const std::string& s, RowRange& r)
+{
+  const auto slash = s.find('/');
+  std::size_t i, n;
+  if (slash == std::string::npos || !parse_count(s.substr(0, slash), i) ||
+      !parse_count(s.substr(slash + 1), n) || n == 0 || i >= n || n > UINT32_MAX)
+    return false;
+  r = RowRange{};
+  r.shard  = static_cast<unsigned>(i);
+  r.shards = static_cast<unsigned>(n);
+  return true;
+}
+
+std::pair<std::size_t, std::size_t> RowRange::resolve(std::size_t nrows) const
+{
+  std::size_t b = std::min(begin, nrows), e = std::min(end, nrows);
+  if (shards > 0) {
+    b = nrows * shard / shards;
+    e = nrows * (shard + 1) / shards;
+  }
+  if (b >= e)
+    throw std::runtime_error("Row band [" + std::to_string(b) + ", " + std::to_string(e) +
+                             ") of a " + std::to_string(nrows) + "-row result is empty");
+  return {b, e};
+}
+
+// names [first, last) of `all`
+static NameTable slice_names(const NameTable& all, std::size_t first, std::size_t last)
+{
+  NameTable t;
+  t.reserve(last - first, all.bytes());
+  for (std::size_t i = first; i < last; ++i) t.add(all[i]);
+  return t;
+}
+
+/* --------------------------------------------------------------------- */
+inline bool next_token(const char *&p, const char *end)
+{
+  while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+  return p < end;
+}
+
+// split on any whitespace; the views point into `s`
+static std::vector<std::string_view> split_ws(const std::string& s)
+{
+  std::vector<std::string_view> out;
+  const char* cur = s.data();
+  const char* end = cur + s.size();
+  while (next_token(cur, end)) {
+    const char* tokBeg = cur;
+    while (cur < end && !std::isspace(static_cast<unsigned char>(*cur))) ++cur;
+    out.emplace_back(tokBeg, static_cast<std::size_t>(cur - tokBeg));
+  }
+  return out;
+}
+
+constexpr std::size_t CHUNK = 32 * 1024 * 1024; // 32 MiB per read
+constexpr std::size_t WIDE_COLS = 32 * 1024;          // columns from which lines are split
+
+// first line of an input, newline stripped
+static std::string read_header_line(InputStream& in)
+{
+  std::string header;
+  if (!in.getline(header)) throw std::runtime_error("Header read error in " + in.path());
+  return header;
+}
+
+// header line of `file` (tokenise with split_ws)
+static std::string read_header_text(const std::string& file)
+{
+  return read_header_line(*open_input(file));
+}
+
+/* -------------------------------------------------------------------------
+   The inputs of one combine.  Streams (stdin, pipes, FIFOs) can be read
+   only once: they are opened, and their header read, before anything else
+   looks at the inputs, and the open stream waits for the accumulation pass.
+   --------------------------------------------------------------------- */
+class InputSet {
+public:
+  explicit InputSet(const std::vector<InputFile>& files)
+    : files_(files), stream_(files.size()), header_(files.size())
+  {
+    bool stdinSeen = false;
+    for (std::size_t f = 0; f < files.size(); ++f) {
+      if (!files[f].stream) continue;
+      if (files[f].path == "-" && std::exchange(stdinSeen, true))
+        throw std::runtime_error("stdin (\"-\") can only be one of the inputs");
+      stream_[f] = open_input(files[f].path);
+      header_[f] = read_header_line(*stream_[f]);
+    }
+  }
+
+  const InputFile& file(std::size_t f) const { return files_[f]; }
+
+  // header line of input f
+  std::string header(std::size_t f) const
+  {
+    return files_[f].stream ? header_[f] : read_header_text(files_[f].path);
+  }
+
+  // input f, positioned after its header line, which goes into `header`
+  std::unique_ptr<InputStream> open(std::size_t f, std::string& header)
+  {
+    if (!files_[f].stream) {
+      auto in = open_input(files_[f].path);
+      header = read_header_line(*in);
+      return in;
+    }
+    if (!stream_[f]) throw std::runtime_error(files_[f].path + " is a stream and was read already");
+    header = header_[f];
+    return std::move(stream_[f]);
+  }
+
+private:
+  const std::vector<InputFile>&             files_;
+  std::vector<std::unique_ptr<InputStream>> stream_;   // streams not taken yet
+  std::vector<std::string>                  header_;
+};
+
+// Run fn(i) for i in [0, n) on up to `threads` threads (the caller's one
+// included); the first exception thrown is rethrown after all have joined.
+template <class Fn>
+static void parallel_for(std::size_t n, unsigned threads, Fn&& fn)
+{
+  std::atomic<std::size_t> next{0};
+  std::exception_ptr       failure;
+  std::mutex               failMu;
+
+  auto worker = [&]() {
+    try {
+      for (std::size_t i; (i = next.fetch_add(1)) < n; ) fn(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(failMu);
+      if (!failure) failure = std::current_exception();
+      next = n;
+    }
+  };
+  const unsigned nt = static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(threads, n)));
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < nt; ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& th : pool) th.join();
+  if (failure) std::rethrow_exception(failure);
+}
+
+// Feed every line left in `in` to onLine(begin, end), newline excluded.
+// Lines that straddle two reads are stitched together in `spill`.
+template <class OnLine>
+static void for_each_line(InputStream& in, std::vector<char>& chunk, OnLine&& onLine)
+{
+  std::string spill; spill.reserve(1024);
+
+  while (true) {
+    const std::size_t got = in.read(chunk.data(), chunk.size());
+    if (got == 0) break;
+    const char* data      = chunk.data();
+    const char* endChunk  = data + got;
+    const char* lineStart = data;
+
+    for (const char* p = data; p < endChunk; ++p) {
+      if (*p == '\n') {
+        if (spill.empty()) {
+          onLine(lineStart, p);
+        } else {
+          spill.append(lineStart, p - lineStart);
+          onLine(spill.data(), spill.data() + spill.size());
+          spill.clear();
+        }
+        lineStart = p + 1;
+      }
+    }
+    if (lineStart < endChunk) spill.append(lineStart, endChunk - lineStart);
+  }
+  // last line without a trailing newline
+  if (!spill.empty()) onLine(spill.data(), spill.data() + spill.size());
+}
+
+inline float parse_float(const char* tok)
+{
+  errno = 0;
+  float v = strtof(tok, nullptr);
+  if (errno == ERANGE) v = (v < 0 ? -FLT_MAX : FLT_MAX);
+  return v;
+}
+
+/* -------------------------------------------------------------------------
+   Row kernels, specialised on where the ID column sits: first (pbwt,
+   ChromoPainter), last (SparsePainter) or anywhere else.  Each is a plain
+   "values, ID, values" run bounded by the number of value columns, with no
+   per-token test of the column index; extra tokens on a line are ignored
+   and a short line just stops early, as before.
+   --------------------------------------------------------------------- */
+enum class IdPos { First, Last, General };
+
+static IdPos id_pos(int idCol, std::size_t nvals)
+{
+  if (idCol == 0) return IdPos::First;
+  return static_cast<std::size_t>(idCol) == nvals ? IdPos::Last : IdPos::General;
+}
+
+// the token `cur` is on; leaves `cur` just past it
+inline std::string_view take_token(const char*& cur, const char* end)
+{
+  const char* beg = cur;
+  while (cur < end && !std::isspace(static_cast<unsigned char>(*cur))) ++cur;
+  return std::string_view(beg, static_cast<std::size_t>(cur - beg));
+}
+
+// value columns [from, to): put(c, v) for each; returns where it stopped
+template <class Put>
+inline std::size_t parse_values(const char*& cur, const char* end,
+                                std::size_t from, std::size_t to, Put& put)
+{
+  std::size_t c = from;
+  for (; c < to && next_token(cur, end); ++c) put(c, parse_float(take_token(cur, end).data()));
+  return c;
+}
+
+// One data line with `n` value columns and the ID at token `idCol`: the
+// ID goes to `id` (left empty if the line is too short to have one).
+// Returns the number of values parsed.
+template <IdPos P, class Put>
+static std::size_t parse_line(const char* cur, const char* end, std::size_t idCol,
+                              std::size_t n, std::string_view& id, Put& put)
+{
+  if constexpr (P == IdPos::First) {
+    if (!next_token(cur, end)) return 0;
+    id = take_token(cur, end);
+    return parse_values(cur, end, 0, n, put);
+  } else if constexpr (P == IdPos::Last) {
+    const std::size_t c = parse_values(cur, end, 0, n, put);
+    if (c == n && next_token(cur, end)) id = take_token(cur, end);
+    return c;
+  } else {
+    const std::size_t c = parse_values(cur, end, 0, std::min(idCol, n), put);
+    if (c < idCol || !next_token(cur, end)) return c;
+    id = take_token(cur, end);
+    return parse_values(cur, end, c, n, put);
+  }
+}
+
+/* -------------------------------------------------------------------------
+   SparsePainter row discovery (rectangular matrices)
+   --------------------------------------------------------------------- */
+static std::size_t collect_row_names_sparsepainter(
+    const std::string        &filename,
+    int                       removeIndex,
+    NameTable                &rowNames)
+{
+  auto fh = open_input(filename);
+
+  // read + discard header (could be very long)
+  std::string header;
+  if (!fh->getline(header)) throw std::runtime_error("[collect] empty file " + filename);
+
+  struct stat st;
+  const double fileBytes = ::stat(filename.c_str(), &st) == 0 ? double(st.st_size) : 0.0;
+  constexpr std::size_t SAMPLE_ROWS = 4096;
+
+  rowNames.clear();
+
+  // read rows; extract the token at removeIndex (i.e., the ID column)
+  std::vector<char> chunk(CHUNK);
+  for_each_line(*fh, chunk, [&](const char* cur, const char* lineEnd) {
+    int col = 0;
+
+    // walk tokens by whitespace
+    while (next_token(cur, lineEnd)) {
+      const char* tokBeg = cur;
+      while (cur < lineEnd && !std::isspace(static_cast<unsigned char>(*cur))) ++cur;
+
+      if (col == removeIndex) {
+        rowNames.add(std::string_view(tokBeg, static_cast<std::size_t>(cur - tokBeg)));
+        break; // we only needed the ID column
+      }
+      ++col;
+    }
+
+    // size the table from the first rows: rows per compressed byte so far,
+    // scaled to the whole file, with 10% slack
+    if (rowNames.size() == SAMPLE_ROWS && fileBytes > 0) {
+      const double used = static_cast<double>(fh->compressed_offset());
+      if (used > 0) {
+        const double rows = 1.1 * SAMPLE_ROWS * fileBytes / used;
+        const double avg  = double(rowNames.bytes()) / SAMPLE_ROWS;
+        rowNames.reserve(static_cast<std::size_t>(rows),
+                         static_cast<std::size_t>(rows * avg));
+      }
+    }
+  });
+
+  return rowNames.size();
+}
+
+/* --------------------------------------------------------------------- */
+// layout from the header line of the first input; SparsePainter rows take
+// a pass over the whole file, which a stream can't spare
+static MatrixLayout layout_of(const std::string& headerLine, const InputFile& first,
+                              InputType type)
+{
+  const std::string& firstFile = first.path;
+  const auto headers = split_ws(headerLine);
+  const std::string_view label = id_label(type);
+
+  MatrixLayout L;
+  for (std::size_t i = 0; i < headers.size(); ++i) {
+    if (headers[i] == label) { L.removeIndex = static_cast<int>(i); break; }
+  }
+  if (L.removeIndex == -1)
+    throw std::runtime_error("Could not locate ID column in header of " + firstFile);
+
+  L.colNames.reserve(headers.size() ? headers.size() - 1 : 0, headerLine.size());
+  for (std::size_t i = 0; i < headers.size(); ++i)
+    if (static_cast<int>(i) != L.removeIndex) L.colNames.add(headers[i]);
+  L.ncols = L.colNames.size();
+
+  if (type == InputType::SparsePainter) {
+    if (first.stream)
+      throw std::runtime_error("SparsePainter rows are listed from the first input, which can't be "
+                               "a stream (" + firstFile + "); put a regular file first");
+    L.nrows = collect_row_names_sparsepainter(firstFile, L.removeIndex, L.rowNames);
+  } else {
+    L.rowNames = L.colNames;  // square matrix for pbwt / chromopainter
+    L.nrows    = L.ncols;
+  }
+  return L;
+}
+
+MatrixLayout discover_layout(const std::string& firstFile, InputType type)
+{
+  return layout_of(read_header_text(firstFile), InputFile{firstFile}, type);
+}
+
+/* --------------------------------------------------------------------- */
+static std::uint64_t fnv1a(std::string_view s, std::uint64_t h = 14695981039346656037ull)
+{
+  for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+  return h;
+}
+
+// ordered hash (chained, with a separator so "ab c" != "a bc") and
+// order-free hash (sum of the per-name hashes) of the non-ID columns
+static void hash_names(const std::vector<std::string_view>& headers, int skip,
+                       std::uint64_t& ordered, std::uint64_t& unordered)
+{
+  ordered = 14695981039346656037ull;
+  unordered = 0;
+  for (std::size_t i = 0; i < headers.size(); ++i) {
+    if (static_cast<int>(i) == skip) continue;
+    ordered = fnv1a(headers[i], ordered);
+    ordered ^= 0xff; ordered *= 1099511628211ull;
+    unordered += fnv1a(headers[i]);
+  }
+}
+
+static HeaderInfo header_info(const std::string& headerLine, InputType type)
+{
+  const auto headers = split_ws(headerLine);
+  const std::string_view label = id_label(type);
+
+  HeaderInfo h;
+  for (std::size_t i = 0; i < headers.size(); ++i)
+    if (headers[i] == label) { h.removeIndex = static_cast<int>(i); break; }
+  h.ncols   = headers.size() - (h.removeIndex >= 0 ? 1 : 0);
+  hash_names(headers, h.removeIndex, h.colHash, h.colSetHash);
+  return h;
+}
+
+HeaderInfo read_header_info(const std::string& file, InputType type)
+{
+  return header_info(read_header_text(file), type);
+}
+
+static void check_headers(const std::vector<InputFile>& files, const InputSet& inputs,
+                          InputType type, unsigned threads, HeaderMatch match)
+{
+  LOG("Checking headers of " << files.size() << " files");
+  std::vector<HeaderInfo>  info(files.size());
+  std::vector<std::string> error(files.size());
+
+  parallel_for(files.size(), threads, [&](std::size_t i) {
+    try {
+      info[i] = header_info(inputs.header(i), type);
+    } catch (const std::exception& e) {
+      error[i] = e.what();
+    }
+  });
+
+  if (!error[0].empty()) throw std::runtime_error(error[0]);
+
+  std::string report;
+  const HeaderInfo& ref = info[0];
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    std::string why = error[i];
+    if (why.empty()) {
+      const HeaderInfo& h = info[i];
+      if (h.removeIndex < 0)
+        why = std::string("no ") + id_label(type) + " column";
+      else if (match == HeaderMatch::IdOnly)
+        ;
+      else if (h.removeIndex != ref.removeIndex && match == HeaderMatch::Exact)
+        why = "ID column at position " + std::to_string(h.removeIndex) +
+              " (expected " + std::to_string(ref.removeIndex) + ")";
+      else if (h.ncols != ref.ncols)
+        why = std::to_string(h.ncols) + " columns (expected " +
+              std::to_string(ref.ncols) + ")";
+      else if (match == HeaderMatch::AnyOrder ? h.colSetHash != ref.colSetHash
+                                              : h.colHash    != ref.colHash)
+        why = "column names differ from " + files[0].path;
+    }
+    if (!why.empty()) report += "\n  " + files[i].path + ": " + why;
+  }
+  if (!report.empty()) throw std::runtime_error("Header check failed:" + report);
+  if (match == HeaderMatch::IdOnly) LOG("Headers OK");
+  else LOG("Headers OK  (" << ref.ncols << " columns in every file)");
+}
+
+void validate_headers(const std::vector<InputFile>& files, InputType type,
+                      unsigned threads, HeaderMatch match)
+{
+  const InputSet inputs(files);
+  check_headers(files, inputs, type, threads, match);
+}
+
+/* -------------------------------------------------------------------------
+   Streaming accumulation of one file into `total` (nrows × ncols)
+   --------------------------------------------------------------------- */
+// name -> index maps of the master order, viewing the layout's strings
+struct Alignment {
+  std::unordered_map<std::string_view, std::size_t> col, row;
+};
+
+static std::unordered_map<std::string_view, std::size_t>
+index_names(const NameTable& names, const char* what)
+{
+  std::unordered_map<std::string_view, std::size_t> idx;
+  idx.reserve(names.size());
+  for (std::size_t i = 0; i < names.size(); ++i)
+    if (!idx.emplace(names[i], i).second)
+      throw std::runtime_error(std::string("Duplicate ") + what + " name " +
+                               std::string(names[i]));
+  return idx;
+}
+
+// what every accumulate_file() call of one combine shares
+struct AccumContext {
+  const MatrixLayout& L;
+  const Alignment*    align;      // null: positional
+  InputType           type;
+  bool                unionMode;  // rows / columns may legitimately be missing
+  InputSet&           inputs;
+  Prefetcher*         prefetch = nullptr;
+  HelperPool*         helpers  = nullptr;   // very wide rows: split long lines
+  std::size_t         rowBegin = 0;         // rows kept: [rowBegin, rowEnd) of
+  std::size_t         rowEnd   = SIZE_MAX;  // the layout, sunk as 0, 1, ...
+  float               scale    = 1.0f;      // on every weight (-1: subtract)
+  // per input, the group matrices (1, 2, ...) it also adds into; null: the
+  // total only.  See Layers.
+  const std::vector<std::vector<std::size_t>>* layers = nullptr;
+};
+
+// The matrices one combine adds into: the total, then one per group
+// (CombineOptions::groups), `rows` rows each.  Sinks take a slot for a row
+// index: row r of matrix l is slot l * rows + r, so band batches and
+// partials carry groups without knowing about them.
+struct Layers {
+  std::vector<float*> base;
+  std::size_t         rows = 0, ncols = 0;
+
+  float*      row(std::size_t slot) const { return base[slot / rows] + (slot % rows) * ncols; }
+  std::size_t slots() const { return base.size() * rows; }
+};
+
+static Layers layers_of(std::vector<AccumBuffer>& m, std::size_t rows, std::size_t ncols)
+{
+  Layers v{{}, rows, ncols};
+  for (auto& b : m) v.base.push_back(b.data());
+  return v;
+}
+
+// Row sinks: where accumulate_file() puts each parsed row (r is a slot, see
+// Layers).
+//   void   add(r, vals, w)  row r += w * vals (ncols staged floats)
+//   float* open_row(r)      ncols floats that row r's values are scattered
+//                           into (aligned rows, already weighted)
+//   void   close_row()      done with the slot returned by open_row()
+//   void   flush()          end of a file or unit: pass on anything buffered
+struct DirectSink {
+  Layers out;
+  void   add(std::size_t r, const float* vals, float w) { add_row(out.row(r), vals, out.ncols, w); }
+  float* open_row(std::size_t r) { return out.row(r); }
+  void   close_row() {}
+  void   flush() {}
+};
+
+// Parses the data lines of one input (or of one unit of it) into a sink.
+// Positional: the n-th line is row firstRow + n, staged and handed over
+// whole.  Aligned: rows and columns are placed by name through the file's
+// own header.  Lines of SPLIT_BYTES or more are parsed a segment per
+// thread when ctx.helpers has idle members.  A row is parsed once and
+// handed to the sink once per matrix its input adds into.
+class RowParser {
+public:
+  RowParser(const AccumContext& ctx, std::size_t f,
+            const std::string& headerLine, std::size_t firstRow = 0)
+    : ctx_(ctx), fname_(ctx.inputs.file(f).path),
+      weight_(ctx.inputs.file(f).weight * ctx.scale), row_(firstRow)
+  {
+    slots_.push_back(0);
+    if (ctx.layers)
+      for (std::size_t l : (*ctx.layers)[f]) slots_.push_back(l * (ctx.rowEnd - ctx.rowBegin));
+
+    if (!ctx.align) {
+      removeIndex_ = ctx.L.removeIndex;
+      pos_ = id_pos(removeIndex_, ctx.L.ncols);
+      vals_.resize(ctx.L.ncols);
+      return;
+    }
+
+    /* ---- aligned: this file's column permutation ---------------------- */
+    const auto headers = split_ws(headerLine);
+    const std::string_view label = id_label(ctx.type);
+    colDest_.reserve(headers.size());
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+      if (removeIndex_ < 0 && headers[i] == label) { removeIndex_ = static_cast<int>(i); continue; }
+      auto it = ctx.align->col.find(headers[i]);
+      if (it == ctx.align->col.end())
+        throw std::runtime_error("Column " + std::string(headers[i]) + " of " + fname_ +
+                                 " is not in the master ID list");
+      colDest_.push_back(it->second);
+    }
+    if (removeIndex_ < 0)
+      throw std::runtime_error("Could not locate ID column in header of " + fname_);
+    vals_.resize(colDest_.size());
+    pos_ = id_pos(removeIndex_, colDest_.size());
+    banded_ = ctx.rowBegin > 0 || ctx.rowEnd < ctx.L.nrows;
+  }
+
+  template <class Sink>
+  void line(const char* cur, const char* lineEnd, Sink& sink, std::vector<char>* rowSeen)
+  {
+    if (!ctx_.align) {
+      /* ---- same order as the first file: stage the row, add it whole ---- */
+      if (row_ >= ctx_.rowBegin && row_ < ctx_.rowEnd && row_ < ctx_.L.nrows) {
+        // rows outside the band, or past the layout's, are only counted
+        std::string_view id;
+        const std::size_t k = parse(cur, lineEnd, id);
+        float* vals = vals_.data();
+        if (k < vals_.size()) std::fill(vals + k, vals + vals_.size(), 0.0f);   // short line
+        for (std::size_t s : slots_) sink.add(s + row_ - ctx_.rowBegin, vals, weight_);
+      }
+      ++row_;
+      ++lines_;
+      return;
+    }
+
+    /* ---- aligned: parse, then scatter through the column permutation ---- */
+    std::string_view id;
+    std::size_t k = 0;
+    if (banded_) id = peek_id(cur, lineEnd);   // rows outside the band are not parsed
+    else         k  = parse(cur, lineEnd, id);
+    if (id.empty()) return;   // blank line
+    ++lines_;
+    auto it = ctx_.align->row.find(id);
+    if (it == ctx_.align->row.end()) { ++unknown_; return; }
+    if (rowSeen) (*rowSeen)[it->second] = 1;
+    if (banded_) {
+      if (it->second < ctx_.rowBegin || it->second >= ctx_.rowEnd) return;
+      k = parse(cur, lineEnd, id);
+    }
+    for (std::size_t s : slots_) {
+      float* dst = sink.open_row(s + it->second - ctx_.rowBegin);
+      for (std::size_t j = 0; j < k; ++j) dst[colDest_[j]] += weight_ * vals_[j];
+      sink.close_row();
+    }
+  }
+
+  std::size_t lines()   const { return lines_; }     // data rows parsed
+  std::size_t unknown() const { return unknown_; }   // aligned: IDs not placed
+
+private:
+  // the ID token alone, no values parsed (the same token parse_line finds)
+  std::string_view peek_id(const char* cur, const char* lineEnd) const
+  {
+    for (int t = 0; next_token(cur, lineEnd); ++t) {
+      const std::string_view tok = take_token(cur, lineEnd);
+      if (t == removeIndex_) return tok;
+    }
+    return {};
+  }
+
+  static constexpr std::size_t SEGMENT_BYTES = 128u << 10;
+  static constexpr std::size_t SPLIT_BYTES   = 2 * SEGMENT_BYTES;
+
+  // One line into vals_ (see parse_line).  The kernel for this file's ID
+  // position is picked once, in the constructor; the switch below always
+  // goes the same way.
+  std::size_t parse(const char* cur, const char* lineEnd, std::string_view& id)
+  {
+    if (ctx_.helpers && static_cast<std::size_t>(lineEnd - cur) >= SPLIT_BYTES) {
+      const std::size_t segs = std::min<std::size_t>(
+          ctx_.helpers->idle() + 1, static_cast<std::size_t>(lineEnd - cur) / SEGMENT_BYTES);
+      if (segs > 1) return parse_split(cur, lineEnd, segs, id);
+    }
+    switch (pos_) {
+      case IdPos::First: return parse_as<IdPos::First>(cur, lineEnd, id);
+      case IdPos::Last:  return parse_as<IdPos::Last>(cur, lineEnd, id);
+      default:           return parse_as<IdPos::General>(cur, lineEnd, id);
+    }
+  }
+
+  template <IdPos P>
+  std::size_t parse_as(const char* cur, const char* lineEnd, std::string_view& id)
+  {
+    float* vals = vals_.data();
+    auto store = [vals](std::size_t c, float v) { vals[c] = v; };
+    return parse_line<P>(cur, lineEnd, static_cast<std::size_t>(removeIndex_),
+                         vals_.size(), id, store);
+  }
+
+  // The same result as parse_line, `segs` threads at once: the line is cut
+  // at whitespace, each segment's tokens are counted, and the running
+  // count puts every segment's first token at its place in the row.
+  std::size_t parse_split(const char* cur, const char* lineEnd, std::size_t segs,
+                          std::string_view& id)
+  {
+    const std::size_t len = static_cast<std::size_t>(lineEnd - cur);
+    cuts_.assign(segs + 1, lineEnd);
+    cuts_[0] = cur;
+    for (std::size_t s = 1; s < segs; ++s) {
+      const char* p = std::max(cur + len / segs * s, cuts_[s - 1]);
+      while (p < lineEnd && !std::isspace(static_cast<unsigned char>(*p))) ++p;
+      cuts_[s] = p;
+    }
+
+    // tokens_[s]: tokens before segment s
+    tokens_.assign(segs + 1, 0);
+    ctx_.helpers->run(segs, [&](std::size_t s) {
+      std::size_t n = 0;
+      for (const char* p = cuts_[s]; next_token(p, cuts_[s + 1]); ++n) take_token(p, cuts_[s + 1]);
+      tokens_[s + 1] = n;
+    });
+    std::partial_sum(tokens_.begin(), tokens_.end(), tokens_.begin());
+
+    // tokens [0, n] are the n values and the ID; anything after is ignored
+    const std::size_t idCol = static_cast<std::size_t>(removeIndex_);
+    const std::size_t n     = vals_.size();
+    float*            vals  = vals_.data();
+    ctx_.helpers->run(segs, [&](std::size_t s) {
+      const char* p = cuts_[s];
+      for (std::size_t t = tokens_[s]; t <= n && next_token(p, cuts_[s + 1]); ++t) {
+        const std::string_view tok = take_token(p, cuts_[s + 1]);
+        if (t == idCol) id = tok;
+        else            vals[t < idCol ? t : t - 1] = parse_float(tok.data());
+      }
+    });
+    const std::size_t total = tokens_[segs];
+    return std::min(n, total > idCol ? total - 1 : total);
+  }
+
+  const AccumContext& ctx_;
+  const std::string&  fname_;
+  float               weight_;
+  int                 removeIndex_ = -1;
+  IdPos               pos_ = IdPos::General;
+  bool                banded_ = false;   // aligned, keeping only some rows
+  std::vector<std::size_t> slots_;    // slot of row 0 in each matrix fed
+  std::vector<std::size_t> colDest_;
+  std::vector<float>       vals_;     // the row being parsed
+  std::vector<const char*> cuts_;     // parse_split(): segment bounds ...
+  std::vector<std::size_t> tokens_;   // ... and token counts
+  std::size_t row_, lines_ = 0, unknown_ = 0;
+};
+
+// end-of-file warnings, once all of a file's rows are in
+static void report_file(const InputFile& in, const AccumContext& ctx,
+                        std::size_t rows, std::size_t unknown)
+{
+  if (unknown)
+    std::cerr << "Warning: " << in.path << " has " << unknown
+              << " rows whose ID is not in the master list (skipped)\n";
+  if (rows != ctx.L.nrows && !ctx.unionMode) {
+    std::cerr << "Warning: " << in.path << " has " << rows
+              << " rows (expected " << ctx.L.nrows << ")\n";
+  }
+  LOG("Finished " << in.path << "  rows=" << rows);
+}
+
+template <class Sink>
+static void accumulate_file(std::size_t         f,
+                            const AccumContext& ctx,
+                            Sink&               sink,
+                            std::vector<char>*  rowSeen,   // union mode only
+                            std::vector<char>&  chunk)
+{
+  const InputFile& in = ctx.inputs.file(f);
+  if (ctx.prefetch) ctx.prefetch->started(f);
+  LOG("Processing " << in.path);
+  std::string header;
+  auto stream = ctx.inputs.open(f, header);
+  RowParser parser(ctx, f, header);
+  for_each_line(*stream, chunk, [&](const char* cur, const char* lineEnd) {
+    parser.line(cur, lineEnd, sink, rowSeen);
+  });
+  stream.reset();
+  report_file(in, ctx, parser.lines(), parser.unknown());
+}
+
+/* -------------------------------------------------------------------------
+   Work units: a whole file, or for BGZF inputs a range of blocks, so one
+   big chromosome can keep several workers busy
+   --------------------------------------------------------------------- */
+constexpr std::size_t UNKNOWN_ROW = static_cast<std::size_t>(-1);
+
+enum class UnitKind {
+  Whole,   // the whole file through open_input()
+  Bgzf,    // [begin, end) are BGZF virtual offsets
+  Gzip,    // [begin, end) are uncompressed offsets, via the .zidx index
+  Zstd     // [begin, end] are uncompressed offsets of seekable-zstd frames
+};
+
+// The lines of file `file` whose first byte lies in [begin, end).
+struct WorkUnit {
+  std::size_t   file   = 0;
+  UnitKind      kind   = UnitKind::Whole;
+  std::uint64_t begin  = 0, end = UINT64_MAX;
+  std::uint64_t prevByte = 0;             // Bgzf: voffset of the byte before `begin`
+  std::size_t   firstRow = UNKNOWN_ROW;   // known: the first whole line is this row
+  bool          skipFirst = false;        // Gzip: `begin` is mid-line
+  std::shared_ptr<const GzIndex> gzi;     // Gzip: the file's index ...
+  std::size_t   point  = 0;               // ... and the access point at `begin`
+  ZstdFrame     frame;                    // Zstd: the frame starting at `begin`
+  std::uint64_t bytes  = 0;               // compressed size, for dealing out
+};
+
+// row starts from <path>.ridx (written with --bgzf), in row order; empty
+// when there is none
+static std::vector<std::uint64_t> read_row_starts(const std::string& path)
+{
+  std::vector<std::uint64_t> starts;
+  std::FILE* fh = std::fopen((path + ".ridx").c_str(), "r");
+  if (!fh) return starts;
+  std::string line;
+  bool first = true;
+  for (int c; (c = std::fgetc(fh)) != EOF; ) {
+    if (c != '\n') { line += static_cast<char>(c); continue; }
+    if (first) {
+      first = false;
+      if (line.rfind("#ridx\t", 0) != 0) break;
+    } else {
+      const auto tab = line.rfind('\t');
+      if (tab != std::string::npos)
+        starts.push_back(std::strtoull(line.c_str() + tab + 1, nullptr, 10));
+    }
+    line.clear();
+  }
+  std::fclose(fh);
+  return starts;
+}
+
+// Units of a plain gzip file from its .zidx access points: every point
+// records how many lines came before it, so the row numbers are known.
+static std::vector<WorkUnit> plan_gzip_units(const InputFile& in, std::size_t file,
+                                             std::uint64_t spacing)
+{
+  auto gzi = std::make_shared<GzIndex>();
+  if (!load_gz_index(in.path, *gzi)) return {};
+
+  std::vector<WorkUnit> units;
+  WorkUnit u;
+  u.file = file; u.kind = UnitKind::Gzip; u.gzi = gzi; u.firstRow = 0;
+  units.push_back(u);
+  std::uint64_t last = 0;
+  for (std::size_t k = 0; k < gzi->points.size(); ++k) {
+    const GzAccessPoint& p = gzi->points[k];
+    if (p.in - last < spacing || p.lines == 0) continue;
+    u.begin     = p.out;
+    u.point     = k;
+    u.skipFirst = p.prev != '\n';
+    u.firstRow  = u.skipFirst ? p.lines : p.lines - 1;   // line 0 is the header
+    u.bytes     = p.in;   // start, turned into a size below
+    units.push_back(u);
+    last = p.in;
+  }
+  for (std::size_t i = 0; i + 1 < units.size(); ++i) units[i].end = units[i + 1].begin;
+  for (std::size_t i = units.size(); i-- > 0; )
+    units[i].bytes = (i + 1 < units.size() ? units[i + 1].bytes : in.bytes) - units[i].bytes;
+  return units;
+}
+
+// Units of a seekable-zstd file, whole frames each.  Frames carry no line
+// numbers, so only for aligned combining.
+static std::vector<WorkUnit> plan_zstd_units(const InputFile& in, std::size_t file,
+                                             std::uint64_t spacing)
+{
+  std::vector<WorkUnit> units;
+  std::uint64_t last = 0;
+  for (const ZstdFrame& f : zstd_seek_table(in.path)) {
+    if (!units.empty() && f.cOffset - last < spacing) continue;
+    WorkUnit u;
+    u.file = file; u.kind = UnitKind::Zstd; u.begin = f.dOffset; u.frame = f;
+    u.bytes = f.cOffset;   // start, turned into a size below
+    units.push_back(u);
+    last = f.cOffset;
+  }
+  for (std::size_t i = 0; i + 1 < units.size(); ++i) units[i].end = units[i + 1].begin;
+  for (std::size_t i = units.size(); i-- > 0; )
+    units[i].bytes = (i + 1 < units.size() ? units[i + 1].bytes : in.bytes) - units[i].bytes;
+  return units;
+}
+
+// Units of one input about `spacing` compressed bytes each.  Plain gzip
+// files split at the access points of their .zidx index, if one was built,
+// seekable zstd at frame boundaries (aligned combining only).
+// Positional combining needs the row number where a unit starts, so there
+// a BGZF file is only split along its .ridx row index; aligned rows are
+// placed by name and any block boundary will do.
+static std::vector<WorkUnit> plan_units(const InputFile& in, std::size_t file,
+                                        const AccumContext& ctx, std::uint64_t spacing)
+{
+  std::vector<WorkUnit> units;
+  WorkUnit whole;
+  whole.file = file; whole.bytes = in.bytes; whole.firstRow = 0;
+  if (spacing == 0 || in.stream || in.bytes < 2 * spacing) return {whole};
+  const Compression comp = detect_compression(in.path);
+  if (comp != Compression::Bgzf) {
+    if (comp == Compression::Gzip)                   units = plan_gzip_units(in, file, spacing);
+    else if (comp == Compression::Zstd && ctx.align) units = plan_zstd_units(in, file, spacing);
+    return units.size() < 2 ? std::vector<WorkUnit>{whole} : units;
+  }
+
+  const auto rowStarts = read_row_starts(in.path);
+  if (!rowStarts.empty()) {
+    std::uint64_t last = 0;
+    for (std::size_t r = 0; r < rowStarts.size(); ++r) {
+      const std::uint64_t c = rowStarts[r] >> 16;
+      if (r == 0 || c - last >= spacing) {
+        WorkUnit u;
+        u.file = file; u.kind = UnitKind::Bgzf; u.begin = r == 0 ? 0 : rowStarts[r];
+        u.firstRow = r;
+        units.push_back(u);
+        last = c;
+      }
+    }
+  } else if (ctx.align) {
+    WorkUnit u;
+    u.file = file; u.kind = UnitKind::Bgzf;
+    units.push_back(u);
+    for (const auto& sp : bgzf_splits(in.path, spacing)) {
+      u.begin = sp.voffset; u.prevByte = sp.prevByte;
+      units.push_back(u);
+    }
+  }
+  if (units.size() < 2) return {whole};
+
+  for (std::size_t i = 0; i < units.size(); ++i) {
+    const std::uint64_t b = units[i].begin >> 16;
+    if (i + 1 < units.size()) units[i].end = units[i + 1].begin;
+    units[i].bytes = (i + 1 < units.size() ? units[i + 1].begin >> 16 : in.bytes) - b;
+  }
+  return units;
+}
+
+// Parse one split unit.  Returns {rows, unknown IDs} of the unit.
+template <class Sink>
+static std::pair<std::size_t, std::size_t>
+accumulate_unit(const InputFile& in, const WorkUnit& u, const AccumContext& ctx,
+                Sink& sink, std::vector<char>* rowSeen, std::string& line)
+{
+  if (u.kind == UnitKind::Zstd) {
+    // a frame may start mid-line: every unit but the first skips its first
+    // (partial) line, and each takes the line that starts right at its end
+    auto rd = u.begin == 0 ? open_input(in.path) : open_zstd_at(in.path, u.frame);
+    RowParser parser(ctx, u.file, u.begin == 0 ? read_header_line(*rd) : read_header_text(in.path));
+    if (u.begin > 0) rd->getline(line);
+    while (rd->tell() <= u.end && rd->getline(line))
+      parser.line(line.data(), line.data() + line.size(), sink, rowSeen);
+    return {parser.lines(), parser.unknown()};
+  }
+
+  if (u.kind == UnitKind::Gzip) {
+    const bool first = u.begin == 0;
+    GzRangeReader rd(*u.gzi, first ? nullptr : &u.gzi->points[u.point]);
+    if (first && !rd.getline(line)) throw std::runtime_error("Empty file " + in.path);
+    RowParser parser(ctx, u.file, first || !ctx.align ? line : read_header_text(in.path),
+                     u.firstRow);
+    if (u.skipFirst) rd.getline(line);   // its first byte belongs to the unit before
+    while (rd.tell() < u.end && rd.getline(line))
+      parser.line(line.data(), line.data() + line.size(), sink, rowSeen);
+    return {parser.lines(), parser.unknown()};
+  }
+
+  BgzfReader rd(in.path);
+  if (!rd.getline(line)) throw std::runtime_error("Empty file " + in.path);
+  RowParser parser(ctx, u.file, line, u.firstRow == UNKNOWN_ROW ? 0 : u.firstRow);
+
+  if (u.begin > 0) {
+    bool lineStart = u.firstRow != UNKNOWN_ROW;
+    if (!lineStart) {
+      char c = 0;
+      rd.seek(u.prevByte);
+      lineStart = rd.read(&c, 1) == 1 && c == '\n';
+    }
+    rd.seek(u.begin);
+    if (!lineStart) rd.getline(line);   // its first byte belongs to the unit before
+  }
+  while (rd.tell() < u.end && rd.getline(line))
+    parser.line(line.data(), line.data() + line.size(), sink, rowSeen);
+  return {parser.lines(), parser.unknown()};
+}
+
+// All units of one combine, dealt out to `workers` work-stealing queues:
+// whole files largest first, each to the queue with the fewest bytes so far.
+class UnitSchedule {
+public:
+  UnitSchedule(const std::vector<InputFile>& files, const AccumContext& ctx,
+               std::vector<std::vector<char>>& rowSeen, unsigned workers,
+               std::uint64_t spacing)
+    : files_(files), ctx_(ctx), rowSeen_(rowSeen), queues_(workers),
+      progress_(files.size())
+  {
+    std::vector<std::vector<WorkUnit>> perFile(files.size());
+    parallel_for(files.size(), workers, [&](std::size_t f) {
+      perFile[f] = plan_units(files[f], f, ctx, spacing);
+    });
+
+    std::vector<std::uint64_t> load(workers, 0);
+    std::size_t nunits = 0;
+    for (std::size_t f : largest_first(files)) {
+      progress_[f].units = progress_[f].left = perFile[f].size();
+      nunits += perFile[f].size();
+      for (const auto& u : perFile[f]) {
+        const unsigned w = static_cast<unsigned>(
+            std::min_element(load.begin(), load.end()) - load.begin());
+        load[w] += u.bytes;
+        queues_.push(w, u);
+      }
+    }
+    units_ = nunits;
+    if (nunits > files.size())
+      LOG(files.size() << " input files split into " << nunits << " work units");
+  }
+
+  std::size_t units() const { return units_; }
+
+  // worker `w`: parse units into `sink` until none are left anywhere, then
+  // help the others with their long lines (if ctx.helpers)
+  template <class Sink>
+  void run(unsigned w, Sink& sink)
+  {
+    try {
+      std::vector<char> chunk;
+      std::string line;
+      WorkUnit u;
+      while (queues_.next(w, u)) {
+        const InputFile& in = files_[u.file];
+        std::vector<char>* seen = rowSeen_.empty() ? nullptr : &rowSeen_[u.file];
+        if (u.kind == UnitKind::Whole) {
+          if (chunk.empty()) chunk.resize(CHUNK);
+          accumulate_file(u.file, ctx_, sink, seen, chunk);
+          sink.flush();
+          continue;
+        }
+        if (ctx_.prefetch) ctx_.prefetch->started(u.file);
+        FileProgress& fp = progress_[u.file];
+        if (u.begin == 0) LOG("Processing " << in.path << " in " << fp.units << " parts");
+        const auto got = accumulate_unit(in, u, ctx_, sink, seen, line);
+        sink.flush();
+        fp.rows    += got.first;
+        fp.unknown += got.second;
+        if (--fp.left == 0) report_file(in, ctx_, fp.rows, fp.unknown);
+      }
+    } catch (...) {
+      queues_.clear();   // stop the others picking up new units
+      if (ctx_.helpers) ctx_.helpers->retire();
+      throw;
+    }
+    if (ctx_.helpers) ctx_.helpers->help();
+  }
+
+private:
+  struct FileProgress {
+    std::size_t              units = 0;
+    std::atomic<std::size_t> left{0}, rows{0}, unknown{0};
+  };
+
+  const std::vector<InputFile>&   files_;
+  const AccumContext&             ctx_;
+  std::vector<std::vector<char>>& rowSeen_;
+  StealQueues<WorkUnit>           queues_;
+  std::vector<FileProgress>       progress_;
+  std::size_t                     units_ = 0;
+};
+
+/* -------------------------------------------------------------------------
+   Union mode: global ID space over all inputs
+   --------------------------------------------------------------------- */
+// append the names not seen yet, keeping first-seen order; `seen` views
+// the callers' strings, which must outlive it
+template <class Names>
+static void merge_names(NameTable& into,
+                        std::unordered_map<std::string_view, std::size_t>& seen,
+                        const Names& names, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    if (seen.emplace(names[i], into.size()).second) into.add(names[i]);
+}
+
+// Union of the column names of all headers (and, for SparsePainter, of
+// the row IDs of all files) in first-seen order.  Sets bit f of
+// colFiles[c * words + f / 64] for every column c present in file f.
+static void build_union(const std::vector<InputFile>& files, const InputSet& inputs,
+                        InputType type, unsigned threads, MatrixLayout& L,
+                        std::size_t words, std::vector<std::uint64_t>& colFiles)
+{
+  const std::string_view label = id_label(type);
+  std::vector<std::string>                   text(files.size());
+  std::vector<std::vector<std::string_view>> cols(files.size());
+  std::vector<int>                           idCol(files.size(), -1);
+
+  parallel_for(files.size(), threads, [&](std::size_t f) {
+    text[f] = inputs.header(f);
+    const auto headers = split_ws(text[f]);
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+      if (idCol[f] < 0 && headers[i] == label) idCol[f] = static_cast<int>(i);
+      else cols[f].push_back(headers[i]);
+    }
+    if (idCol[f] < 0)
+      throw std::runtime_error("Could not locate ID column in header of " + files[f].path);
+  });
+
+  std::unordered_map<std::string_view, std::size_t> seen;
+  L.colNames.clear();
+  for (const auto& c : cols) merge_names(L.colNames, seen, c, c.size());
+  L.ncols = L.colNames.size();
+
+  colFiles.assign(L.ncols * words, 0);
+  for (std::size_t f = 0; f < files.size(); ++f)
+    for (const auto& c : cols[f])
+      colFiles[seen[c] * words + f / 64] |= std::uint64_t{1} << (f % 64);
+
+  if (type == InputType::SparsePainter) {
+    // recipients are not in the header: one extra pass over the ID column
+    for (const auto& f : files)
+      if (f.stream)
+        throw std::runtime_error("--union over SparsePainter inputs reads every file twice; " +
+                                 f.path + " is a stream");
+    std::vector<NameTable> rows(files.size());
+    parallel_for(files.size(), threads, [&](std::size_t f) {
+      collect_row_names_sparsepainter(files[f].path, idCol[f], rows[f]);
+    });
+    std::unordered_map<std::string_view, std::size_t> seenRows;
+    L.rowNames.clear();
+    for (const auto& r : rows) merge_names(L.rowNames, seenRows, r, r.size());
+  } else {
+    L.rowNames = L.colNames;
+  }
+  L.nrows = L.rowNames.size();
+}
+
+/* --------------------------------------------------------------------- */
+static AccumBuffer alloc_matrix(std::size_t nrows, std::size_t ncols, HugePages hp)
+{
+  try {
+    return AccumBuffer(nrows * ncols, hp);
+  } catch (const std::exception&) {
+    throw std::runtime_error("Memory allocation failed for matrix of size " +
+                             std::to_string(nrows) + " x " + std::to_string(ncols));
+  }
+}
+
+// Run fn(t) on threads t = 0 .. n-1, thread t pinned to NUMA node
+// t % numa_nodes() when `pin`; rethrows the first exception after joining.
+template <class Fn>
+static void run_workers(unsigned n, bool pin, Fn&& fn)
+{
+  std::exception_ptr failure;
+  std::mutex         failMu;
+  const int          nodes = pin ? numa_nodes() : 1;
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < n; ++t) {
+    pool.emplace_back([&, t]() {
+      try {
+        if (pin) pin_to_node(static_cast<int>(t % static_cast<unsigned>(nodes)));
+        fn(t);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(failMu);
+        if (!failure) failure = std::current_exception();
+      }
+    });
+  }
+  for (auto& th : pool) th.join();
+  if (failure) std::rethrow_exception(failure);
+}
+
+// rows [first, last) of band t out of n: exactly the rows r with
+// band_of(r, nrows, n) == t
+static std::pair<std::size_t, std::size_t> row_band(std::size_t nrows, unsigned t, unsigned n)
+{
+  return {(nrows * t + n - 1) / n, (nrows * (t + 1) + n - 1) / n};
+}
+
+static unsigned band_of(std::size_t r, std::size_t nrows, unsigned n)
+{
+  return static_cast<unsigned>(r * n / nrows);
+}
+
+/* -------------------------------------------------------------------------
+   Row-band ownership: one copy of the matrix, split into row bands each
+   owned by one accumulator thread.  Parser threads take whole files and
+   route every parsed row, in batches, to its band's owner through one pair
+   of SPSC queues per (parser, owner): full batches one way, emptied ones
+   back.  No cell is ever written by two threads.
+   --------------------------------------------------------------------- */
+// thrown in threads that stop because another one failed; that other
+// thread's exception is the one reported
+struct BandAbort {};
+
+struct RowBatch {
+  std::vector<std::size_t> rows;      // destination row of each slot
+  std::vector<float>       weights;   // each slot's scale
+  std::vector<float>       vals;      // rows.size() × ncols, added by the owner
+  std::size_t              n = 0;
+};
+
+struct BandChannels {
+  SpscQueue<RowBatch*> full{8}, empty{8};
+  std::vector<std::unique_ptr<RowBatch>> owned;   // batches of this pair
+};
+
+class BandSink {
+public:
+  BandSink(std::vector<BandChannels*> ch, std::size_t nrows, std::size_t ncols,
+           std::size_t batchRows, const std::atomic<bool>& abort)
+    : ch_(std::move(ch)), cur_(ch_.size(), nullptr), nrows_(nrows),
+      ncols_(ncols), batchRows_(batchRows), abort_(abort) {}
+
+  // staged rows are copied as parsed; the owner applies the weight
+  void add(std::size_t r, const float* vals, float w)
+  {
+    float* slot = slot_for(r, w);
+    std::copy(vals, vals + ncols_, slot);
+    close_row();
+  }
+
+  float* open_row(std::size_t r)
+  {
+    float* slot = slot_for(r, 1.0f);
+    std::fill(slot, slot + ncols_, 0.0f);
+    return slot;
+  }
+
+  void close_row()
+  {
+    RowBatch*& b = cur_[owner_];
+    if (++b->n == batchRows_) { send(*ch_[owner_], b); b = nullptr; }
+  }
+
+  void flush()
+  {
+    for (std::size_t o = 0; o < ch_.size(); ++o)
+      if (cur_[o]) { send(*ch_[o], cur_[o]); cur_[o] = nullptr; }
+  }
+
+private:
+  static constexpr std::size_t BATCHES_PER_PAIR = 4;
+
+  float* slot_for(std::size_t r, float w)
+  {
+    owner_ = band_of(r, nrows_, static_cast<unsigned>(ch_.size()));
+    RowBatch*& b = cur_[owner_];
+    if (!b) b = take(*ch_[owner_]);
+    b->rows[b->n]    = r;
+    b->weights[b->n] = w;
+    return b->vals.data() + b->n * ncols_;
+  }
+
+  RowBatch* take(BandChannels& c)
+  {
+    RowBatch* b = nullptr;
+    while (!c.empty.pop(b)) {
+      if (c.owned.size() < BATCHES_PER_PAIR) {
+        c.owned.push_back(std::make_unique<RowBatch>());
+        b = c.owned.back().get();
+        b->rows.resize(batchRows_);
+        b->weights.resize(batchRows_);
+        b->vals.resize(batchRows_ * ncols_);
+        break;
+      }
+      if (abort_) throw BandAbort{};
+      std::this_thread::yield();
+    }
+    b->n = 0;
+    return b;
+  }
+
+  void send(BandChannels& c, RowBatch* b)
+  {
+    while (!c.full.push(b)) {
+      if (abort_) throw BandAbort{};
+      std::this_thread::yield();
+    }
+  }
+
+  std::vector<BandChannels*> ch_;
+  std::vector<RowBatch*>     cur_;
+  std::size_t nrows_, ncols_, batchRows_;
+  unsigned    owner_ = 0;
+  const std::atomic<bool>& abort_;
+};
+
+// `out`: the total and any group matrices, banded as one stack of slots
+static void accumulate_banded(UnitSchedule& sched, unsigned parsers,
+                              const AccumContext& ctx, const CombineOptions& opts,
+                              std::vector<AccumBuffer>& out)
+{
+  const std::size_t ncols = ctx.L.ncols;
+  const Layers      dst   = layers_of(out, ctx.rowEnd - ctx.rowBegin, ncols);
+  const std::size_t nrows = dst.slots();
+  const unsigned owners  = static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(opts.bands, nrows)));
+  const std::size_t batchRows = std::max<std::size_t>(1, (256u << 10) / std::max<std::size_t>(1, ncols));
+  LOG("row-band mode: " << parsers << " parser(s), " << owners << " band owner(s)");
+
+  // chan[p * owners + o] links parser p to owner o
+  std::vector<BandChannels> chan(std::size_t{parsers} * owners);
+  std::atomic<unsigned>     parsersDone{0};
+  std::atomic<bool>         abort{false};
+
+  // threads past the owners only help the parsers with long lines
+  const unsigned helpers = ctx.helpers ? ctx.helpers->members() - parsers : 0;
+  run_workers(parsers + owners + helpers, false, [&](unsigned t) {
+    try {
+      if (t >= parsers + owners) { ctx.helpers->help(); return; }
+      if (t < parsers) {
+        /* ---- parser: units of work, rows routed to their band's owner */
+        std::vector<BandChannels*> mine;
+        for (unsigned o = 0; o < owners; ++o) mine.push_back(&chan[t * owners + o]);
+        BandSink sink(mine, nrows, ncols, batchRows, abort);
+        sched.run(t, sink);
+        parsersDone.fetch_add(1, std::memory_order_release);
+        return;
+      }
+
+      /* ---- owner: add batches into its band until every parser is done */
+      const unsigned o = t - parsers;
+      if (opts.numa) {
+        pin_to_node(static_cast<int>(o % static_cast<unsigned>(numa_nodes())));
+        const auto band = row_band(nrows, o, owners);
+        for (std::size_t l = 0; l < out.size(); ++l) {
+          const std::size_t lo = std::max(band.first, l * dst.rows);
+          const std::size_t hi = std::min(band.second, (l + 1) * dst.rows);
+          if (lo < hi) out[l].first_touch((lo - l * dst.rows) * ncols, (hi - l * dst.rows) * ncols);
+        }
+      }
+      while (!abort) {
+        const bool last = parsersDone.load(std::memory_order_acquire) == parsers;
+        bool any = false;
+        for (unsigned p = 0; p < parsers; ++p) {
+          BandChannels& c = chan[p * owners + o];
+          for (RowBatch* b; c.full.pop(b); ) {
+            for (std::size_t k = 0; k < b->n; ++k) {
+              if (k + 1 < b->n) prefetch_row(dst.row(b->rows[k + 1]), ncols);
+              add_row(dst.row(b->rows[k]), b->vals.data() + k * ncols, ncols, b->weights[k]);
+            }
+            c.empty.push(b);   // never full: a pair owns at most 4 batches
+            any = true;
+          }
+        }
+        if (last && !any) break;   // nothing sent after the parsers finished
+        if (!any) std::this_thread::yield();
+      }
+    } catch (const BandAbort&) {
+    } catch (...) {
+      abort = true;
+      throw;
+    }
+  });
+}
+
+// The jackknife pass of combine_files(): each worker copies `m` into its
+// own matrix, then subtracts the inputs it takes, one at a time, in `order`.
+static void leave_one_out(const AccumContext& ctx, const std::vector<std::size_t>& order,
+                          const CombinedMatrix& m, unsigned threads, HugePages hp,
+                          LeaveOneOutput& out)
+{
+  const unsigned nt = static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(threads, order.size())));
+  std::atomic<std::size_t> next{0};
+  run_workers(nt, false, [&](unsigned) {
+    CombinedMatrix loco;
+    loco.type      = m.type;
+    loco.rowNames  = m.rowNames;
+    loco.colNames  = m.colNames;
+    loco.nrows     = m.nrows;
+    loco.ncols     = m.ncols;
+    loco.nfiles    = m.nfiles - 1;
+    loco.maskWords = m.maskWords;
+    loco.firstRow  = m.firstRow;
+    loco.fullRows  = m.fullRows;
+    loco.total     = alloc_matrix(m.nrows, m.ncols, hp);
+    const std::size_t cells = m.nrows * m.ncols;
+
+    std::vector<char> chunk(CHUNK);
+    DirectSink sink{Layers{{loco.total.data()}, m.nrows, m.ncols}};
+    for (std::size_t i; (i = next.fetch_add(1)) < order.size(); ) {
+      const std::size_t f = order[i];
+      std::copy(m.total.data(), m.total.data() + cells, loco.total.data());
+      accumulate_file(f, ctx, sink, nullptr, chunk);
+      if (m.maskWords) {
+        const std::uint64_t bit = ~(std::uint64_t{1} << (f % 64));
+        loco.rowFiles = m.rowFiles;
+        loco.colFiles = m.colFiles;
+        for (std::size_t w = f / 64; w < loco.rowFiles.size(); w += m.maskWords) loco.rowFiles[w] &= bit;
+        for (std::size_t w = f / 64; w < loco.colFiles.size(); w += m.maskWords) loco.colFiles[w] &= bit;
+      }
+      out.write(f, loco);
+    }
+  });
+}
+
+CombinedMatrix combine_files(std::vector<InputFile>       files,
+                             const CombineOptions&        opts,
+                             LeaveOneOutput*              jackknife,
+                             std::vector<CombinedMatrix>* groupSums)
+{
+  if (files.empty()) throw std::runtime_error("No input files specified");
+  stat_inputs(files);   // fail on a missing file before any work is done
+  if (jackknife)
+    for (const auto& f : files)
+      if (f.stream)
+        throw std::runtime_error("--jackknife reads every input twice; " + f.path +
+                                 " is a stream");
+  std::uint64_t bytes = 0;
+  for (const auto& f : files) bytes += f.bytes;
+  LOG(files.size() << " input files, " << (bytes >> 20) << " MiB on disk");
+
+  const bool aligned = opts.align || opts.unionIds || !opts.masterIds.empty();
+  InputSet inputs(files);
+  if (opts.validate) check_headers(files, inputs, opts.type, opts.threads, header_match(opts));
+
+  CombinedMatrix m;
+  MatrixLayout   L;
+  if (opts.unionIds) {
+    m.maskWords = (files.size() + 63) / 64;
+    build_union(files, inputs, opts.type, opts.threads, L, m.maskWords, m.colFiles);
+    LOG("union of all inputs: " << L.nrows << " rows, " << L.ncols << " cols");
+  } else {
+    L = layout_of(inputs.header(0), files[0], opts.type);
+  }
+  if (!opts.masterIds.empty() && !opts.unionIds) {
+    L.colNames = NameTable::from(read_id_list(opts.masterIds));
+    L.ncols    = L.colNames.size();
+    if (opts.type != InputType::SparsePainter) {
+      L.rowNames = L.colNames;
+      L.nrows    = L.ncols;
+    }
+    LOG("master order from " << opts.masterIds);
+  }
+
+  std::unique_ptr<Alignment> align;
+  if (aligned) {
+    align = std::make_unique<Alignment>();
+    align->col = index_names(L.colNames, "column");
+    align->row = index_names(L.rowNames, "row");
+    LOG("aligning rows and columns by name");
+  }
+  LOG("matrix size will be " << L.nrows << " rows × " << L.ncols << " cols"
+      << " (" << add_row_kernel() << " row kernel)");
+  const auto band = opts.rows.resolve(L.nrows);
+  const std::size_t nrows = band.second - band.first;   // rows held
+  if (!opts.rows.whole()) {
+    LOG("keeping rows [" << band.first << ", " << band.second << ") only");
+    m.firstRow = band.first;
+    m.fullRows = L.nrows;
+  }
+
+  // the total, then one matrix per group, each input adding into the
+  // total and its groups' matrices
+  const std::size_t ngroups = groupSums ? opts.groups.size() : 0;
+  std::vector<std::vector<std::size_t>> fileLayers(ngroups ? files.size() : 0);
+  for (std::size_t g = 0; g < ngroups; ++g)
+    for (std::size_t f : opts.groups[g]) {
+      if (f >= files.size()) throw std::runtime_error("Group input number out of range");
+      fileLayers[f].push_back(g + 1);
+    }
+  if (ngroups) LOG(ngroups << " group sum(s) besides the total, from the same pass");
+
+  m.type   = opts.type;
+  m.nrows  = nrows;
+  m.ncols  = L.ncols;
+  m.nfiles = files.size();
+  std::vector<AccumBuffer> out(1 + ngroups);
+  for (auto& b : out) b = alloc_matrix(nrows, L.ncols, opts.hugePages);
+  if (opts.hugePages != HugePages::Off)
+    LOG("accumulator huge pages: " <<
+        (out[0].huge_pages() == HugePages::Explicit    ? "explicit" :
+         out[0].huge_pages() == HugePages::Transparent ? "transparent" : "unavailable"));
+  const auto t0 = std::chrono::steady_clock::now();
+
+  const bool parallel = opts.threads > 1 || opts.bands > 0;
+  std::unique_ptr<Prefetcher> prefetch;
+  if (opts.prefetchBytes > 0 && files.size() > 1) {
+    std::vector<std::size_t> order(files.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    if (parallel) order = largest_first(files);   // the order UnitSchedule deals them
+    prefetch = std::make_unique<Prefetcher>(files, std::move(order), opts.prefetchBytes);
+  }
+
+  // Very wide rows: workers with no units left, and up to `threads` extra
+  // ones when there are fewer units than that, parse segments of the long
+  // lines the others are still on.
+  std::unique_ptr<HelperPool> helpers;
+  if (opts.threads > 1 && L.ncols >= WIDE_COLS) helpers = std::make_unique<HelperPool>(opts.threads);
+
+  const AccumContext ctx{L, align.get(), opts.type, opts.unionIds, inputs, prefetch.get(),
+                         helpers.get(), band.first, band.second, 1.0f,
+                         ngroups ? &fileLayers : nullptr};
+  std::vector<std::vector<char>> rowSeen(opts.unionIds ? files.size() : 0);
+  for (auto& r : rowSeen) r.assign(L.nrows, 0);
+  auto seen = [&](std::size_t f) { return opts.unionIds ? &rowSeen[f] : nullptr; };
+
+  std::unique_ptr<UnitSchedule> sched;
+  unsigned nthreads = 1;
+  if (parallel) {
+    sched = std::make_unique<UnitSchedule>(files, ctx, rowSeen, std::max(1u, opts.threads),
+                                           opts.splitBytes);
+    nthreads = static_cast<unsigned>(
+        std::max<std::size_t>(1, std::min<std::size_t>(opts.threads, sched->units())));
+  }
+
+  if (opts.bands > 0) {
+    accumulate_banded(*sched, nthreads, ctx, opts, out);
+  } else if (nthreads == 1 && !helpers) {
+    std::vector<char> chunk(CHUNK);
+    DirectSink sink{layers_of(out, nrows, L.ncols)};
+    for (std::size_t f = 0; f < files.size(); ++f)
+      accumulate_file(f, ctx, sink, seen(f), chunk);
+  } else {
+    // worker 0 accumulates straight into the result, the others into
+    // private partials that are folded in once every file is done
+    std::vector<std::vector<AccumBuffer>> partial(nthreads - 1);
+    for (auto& p : partial) {
+      p.resize(out.size());
+      for (auto& b : p) b = alloc_matrix(nrows, L.ncols, opts.hugePages);
+    }
+
+    if (opts.numa) {
+      // place each worker's partial, and its row band of the result (which
+      // it reduces into at the end), on that worker's node
+      LOG("NUMA placement over " << numa_nodes() << " node(s)");
+      run_workers(nthreads, true, [&](unsigned t) {
+        const auto part = row_band(nrows, t, nthreads);
+        for (auto& b : out) b.first_touch(part.first * L.ncols, part.second * L.ncols);
+        if (t > 0)
+          for (auto& b : partial[t - 1]) b.first_touch(0, b.size());
+      });
+    }
+
+    run_workers(helpers ? opts.threads : nthreads, opts.numa, [&](unsigned t) {
+      if (t >= nthreads) { helpers->help(); return; }
+      DirectSink sink{layers_of(t == 0 ? out : partial[t - 1], nrows, L.ncols)};
+      sched->run(t, sink);
+    });
+
+    // fold the partials in, one row band per worker
+    run_workers(nthreads, opts.numa, [&](unsigned t) {
+      const auto part = row_band(nrows, t, nthreads);
+      const std::size_t n = (part.second - part.first) * L.ncols;
+      for (std::size_t l = 0; l < out.size(); ++l) {
+        float* dst = out[l].data() + part.first * L.ncols;
+        for (const auto& p : partial) add_row(dst, p[l].data() + part.first * L.ncols, n);
+      }
+    });
+  }
+  m.total = std::move(out[0]);
+  LOG("Accumulation took " << std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - t0).count() << " s");
+
+  if (opts.unionIds) {
+    m.rowFiles.assign(m.nrows * m.maskWords, 0);
+    for (std::size_t f = 0; f < files.size(); ++f)
+      for (std::size_t r = 0; r < m.nrows; ++r)
+        if (rowSeen[f][band.first + r])
+          m.rowFiles[r * m.maskWords + f / 64] |= std::uint64_t{1} << (f % 64);
+  }
+
+  m.rowNames = opts.rows.whole() ? std::move(L.rowNames)
+                                 : slice_names(L.rowNames, band.first, band.second);
+  m.colNames = std::move(L.colNames);   // (the Alignment's views stay valid)
+
+  for (std::size_t g = 0; g < ngroups; ++g) {
+    CombinedMatrix gm;
+    gm.type      = m.type;
+    gm.rowNames  = m.rowNames;
+    gm.colNames  = m.colNames;
+    gm.nrows     = m.nrows;
+    gm.ncols     = m.ncols;
+    gm.total     = std::move(out[g + 1]);
+    gm.nfiles    = opts.groups[g].size();
+    gm.firstRow  = m.firstRow;
+    gm.fullRows  = m.fullRows;
+    gm.maskWords = m.maskWords;
+    if (m.maskWords) {
+      // only the group's inputs count towards its cells
+      std::vector<std::uint64_t> members(m.maskWords, 0);
+      for (std::size_t f : opts.groups[g]) members[f / 64] |= std::uint64_t{1} << (f % 64);
+      gm.rowFiles = m.rowFiles;
+      gm.colFiles = m.colFiles;
+      for (std::size_t i = 0; i < gm.rowFiles.size(); ++i) gm.rowFiles[i] &= members[i % m.maskWords];
+      for (std::size_t i = 0; i < gm.colFiles.size(); ++i) gm.colFiles[i] &= members[i % m.maskWords];
+    }
+    groupSums->push_back(std::move(gm));
+  }
+
+  if (jackknife) {
+    const auto t1 = std::chrono::steady_clock::now();
+    LOG("Leave-one-out pass over " << files.size() << " inputs");
+    std::vector<std::size_t> order(files.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    if (opts.threads > 1) order = largest_first(files);
+    prefetch.reset();
+    if (opts.prefetchBytes > 0 && files.size() > 1)
+      prefetch = std::make_unique<Prefetcher>(files, order, opts.prefetchBytes);
+    AccumContext loo = ctx;
+    loo.prefetch = prefetch.get();
+    loo.helpers  = nullptr;
+    loo.scale    = -1.0f;
+    loo.layers   = nullptr;   // the total only
+    leave_one_out(loo, order, m, opts.threads, opts.hugePages, *jackknife);
+    LOG("Leave-one-out pass took " << std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t1).count() << " s");
+  }
+  return m;
+}
+
+/* --------------------------------------------------------------------- */
+// positional rows [first, first + n) of one batch
+struct BatchSink {
+  float*      buf;
+  std::size_t first, ncols;
+  void   add(std::size_t r, const float* vals, float w) { add_row(open_row(r), vals, ncols, w); }
+  float* open_row(std::size_t r) { return buf + (r - first) * ncols; }
+  void   close_row() {}
+  void   flush() {}
+};
+
+// The lockstep workers meet here twice per batch.  A worker that fails
+// breaks the barrier, so the others return instead of waiting forever.
+class BatchBarrier {
+public:
+  explicit BatchBarrier(unsigned n) : n_(n) {}
+
+  // wait for all n workers; false once broken
+  bool wait()
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    if (broken_) return false;
+    const std::size_t gen = gen_;
+    if (++waiting_ == n_) {
+      waiting_ = 0;
+      ++gen_;
+      cv_.notify_all();
+      return true;
+    }
+    cv_.wait(lk, [&] { return gen_ != gen || broken_; });
+    return !broken_;
+  }
+
+  void abandon()
+  {
+    { std::lock_guard<std::mutex> lk(mu_); broken_ = true; }
+    cv_.notify_all();
+  }
+
+private:
+  const unsigned          n_;
+  std::mutex              mu_;
+  std::condition_variable cv_;
+  unsigned                waiting_ = 0;
+  std::size_t             gen_     = 0;
+  bool                    broken_  = false;
+};
+
+void combine_lockstep(std::vector<InputFile> files, const CombineOptions& opts,
+                      RowOutput& out, bool mean)
+{
+  if (files.empty()) throw std::runtime_error("No input files specified");
+  if (opts.align || opts.unionIds || !opts.masterIds.empty())
+    throw std::runtime_error("Lockstep merging needs every input in the same row order; "
+                             "it can't be used with --align, --master-ids or --union");
+  stat_inputs(files);
+  LOG(files.size() << " input files, merged in lockstep");
+
+  InputSet inputs(files);
+  if (opts.validate) check_headers(files, inputs, opts.type, opts.threads, HeaderMatch::Exact);
+  MatrixLayout L = layout_of(inputs.header(0), files[0], opts.type);
+  LOG("output will be " << L.nrows << " rows × " << L.ncols << " cols");
+  const auto band = opts.rows.resolve(L.nrows);
+  const std::size_t nrows = band.second - band.first;
+
+  CombinedMatrix shape;
+  shape.type   = opts.type;
+  shape.nrows  = nrows;
+  shape.ncols  = L.ncols;
+  shape.nfiles = files.size();
+  shape.rowNames = slice_names(L.rowNames, band.first, band.second);
+  shape.colNames = L.colNames;
+  if (!opts.rows.whole()) {
+    LOG("keeping rows [" << band.first << ", " << band.second << ") only");
+    shape.firstRow = band.first;
+    shape.fullRows = L.nrows;
+  }
+
+  const AccumContext ctx{L, nullptr, opts.type, false, inputs, nullptr, nullptr,
+                         band.first, band.second};
+  struct Source {
+    std::unique_ptr<InputStream> in;
+    std::unique_ptr<RowParser>   parser;
+  };
+  std::vector<Source> src(files.size());
+  for (std::size_t f = 0; f < files.size(); ++f) {
+    std::string header;
+    src[f].in     = inputs.open(f, header);
+    src[f].parser = std::make_unique<RowParser>(ctx, f, header);
+  }
+
+  const std::size_t ncols = L.ncols;
+  const std::size_t batch = std::max<std::size_t>(1, (256u << 10) / std::max<std::size_t>(1, ncols));
+  const unsigned workers  = static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(opts.threads, files.size())));
+  std::vector<std::vector<float>> part(workers, std::vector<float>(batch * ncols));
+  LOG("lockstep: " << workers << " worker(s), " << batch << " rows per batch");
+
+  out.begin(shape);
+  const auto t0 = std::chrono::steady_clock::now();
+
+  // rows before the band are counted, not parsed
+  if (band.first > 0)
+    parallel_for(files.size(), workers, [&](std::size_t f) {
+      BatchSink none{nullptr, 0, 0};
+      std::string line;
+      for (std::size_t k = 0; k < band.first && src[f].in->getline(line); ++k)
+        src[f].parser->line(line.data(), line.data() + line.size(), none, nullptr);
+    });
+
+  // The workers start once.  For each batch every worker takes files one
+  // at a time and parses their band rows [r0, r0 + n) into its own buffer;
+  // once all files are in, worker 0 sums the buffers and writes the batch
+  // while the others wait for the next one.
+  BatchBarrier             barrier(workers);
+  std::atomic<std::size_t> nextFile{0};
+  run_workers(workers, false, [&](unsigned t) {
+    try {
+      std::string line;
+      for (std::size_t r0 = 0; r0 < nrows; r0 += batch) {
+        const std::size_t n = std::min(batch, nrows - r0);
+        std::fill(part[t].begin(), part[t].begin() + n * ncols, 0.0f);
+        BatchSink sink{part[t].data(), r0, ncols};
+        for (std::size_t f; (f = nextFile.fetch_add(1)) < src.size(); )
+          for (std::size_t k = 0; k < n && src[f].in->getline(line); ++k)
+            src[f].parser->line(line.data(), line.data() + line.size(), sink, nullptr);
+        if (!barrier.wait()) return;   // every file's rows are parsed
+
+        if (t == 0) {
+          float* sum = part[0].data();
+          for (unsigned w = 1; w < workers; ++w) add_row(sum, part[w].data(), n * ncols);
+          if (mean)
+            for (std::size_t i = 0; i < n * ncols; ++i) sum[i] /= static_cast<float>(files.size());
+          out.write_rows(sum, n);
+          nextFile = 0;
+        }
+        if (!barrier.wait()) return;   // the buffers are free again
+      }
+    } catch (...) {
+      barrier.abandon();
+      throw;
+    }
+  });
+
+  // count the rows after the band and any past the layout's, for the usual warning
+  parallel_for(files.size(), workers, [&](std::size_t f) {
+    std::vector<char> chunk(1 << 20);
+    BatchSink none{nullptr, 0, 0};
+    for_each_line(*src[f].in, chunk, [&](const char* cur, const char* end) {
+      src[f].parser->line(cur, end, none, nullptr);
+    });
+    src[f].in.reset();
+  });
+  for (std::size_t f = 0; f < files.size(); ++f)
+    report_file(files[f], ctx, src[f].parser->lines(), 0);
+  out.end();
+  LOG("Lockstep merge took " << std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - t0).count() << " s");
+}
+
+/* --------------------------------------------------------------------- */
+void index_inputs(const std::vector<InputFile>& files, unsigned threads,
+                  std::uint64_t spacing)
+{
+  parallel_for(files.size(), threads, [&](std::size_t f) {
+    const std::string& path = files[f].path;
+    if (is_stream(path)) {
+      LOG(path << " is a stream, it can't be indexed");
+      return;
+    }
+    const Compression c = detect_compression(path);
+    if (c != Compression::Gzip) {
+      LOG(path << " is " << compression_name(c) << ", no index needed");
+      return;
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    const GzIndex idx = build_gz_index(path, spacing);
+    const double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+    LOG("Indexed " << path << ": " << idx.points.size() << " access points in "
+        << secs << " s");
+  });
+}
+
+/* --------------------------------------------------------------------- */
+HeaderMatch header_match(const CombineOptions& opts)
+{
+  if (opts.unionIds) return HeaderMatch::IdOnly;
+  if (opts.align || !opts.masterIds.empty()) return HeaderMatch::AnyOrder;
+  return HeaderMatch::Exact;
+}
+
+std::uint32_t CombinedMatrix::present(std::size_t r, std::size_t c) const
+{
+  if (!maskWords) return static_cast<std::uint32_t>(nfiles);
+  std::uint32_t n = 0;
+  const std::uint64_t* rw = rowFiles.data() + r * maskWords;
+  const std::uint64_t* cw = colFiles.data() + c * maskWords;
+  for (std::size_t w = 0; w < maskWords; ++w)
+    n += static_cast<std::uint32_t>(__builtin_popcountll(rw[w] & cw[w]));
+  return n;
+}
+
+void mean_over_present(CombinedMatrix& m)
+{
+  for (std::size_t r = 0; r < m.nrows; ++r) {
+    float* row = m.total.data() + r * m.ncols;
+    for (std::size_t c = 0; c < m.ncols; ++c) {
+      const std::uint32_t n = m.present(r, c);
+      if (n) row[c] /= static_cast<float>(n);
+    }
+  }
+}
+
+/* -------------------------------------------------------------------------
+   Reducing combined outputs
+   --------------------------------------------------------------------- */
+constexpr std::size_t REDUCE_BATCH = std::size_t{4} << 20;   // bytes read at a time
+
+// Add the rest of `in` into `dst` (nrows × ncols, row names `rows`),
+// checking it has exactly those rows.
+static void add_output(MatrixReader& in, float* dst, const NameTable& rows, std::size_t ncols,
+                       std::vector<float>& batch)
+{
+  const std::size_t per = std::max<std::size_t>(1, REDUCE_BATCH / (ncols * sizeof(float)));
+  batch.resize(per * ncols);
+  NameTable names;
+  std::size_t r = 0;
+  for (std::size_t k; (k = in.read_rows(batch.data(), per, names)) > 0; names.clear()) {
+    for (std::size_t i = 0; i < k; ++i, ++r) {
+      if (r == rows.size())
+        throw std::runtime_error(in.path() + " has more than the " + std::to_string(rows.size()) +
+                                 " rows of the others");
+      if (names[i] != rows[r])
+        throw std::runtime_error("Row " + std::to_string(r) + " of " + in.path() + " is " +
+                                 std::string(names[i]) + ", expected " + std::string(rows[r]));
+      add_row(dst + r * ncols, batch.data() + i * ncols, ncols);
+    }
+  }
+  if (r != rows.size())
+    throw std::runtime_error(in.path() + " has " + std::to_string(r) + " rows, expected " +
+                             std::to_string(rows.size()));
+}
+
+// Rows of a text output as listed in its BGZF row index (<path>.ridx, one
+// line per row after the "#ridx" header); 0 if it has none.
+static std::size_t indexed_text_rows(const std::string& path)
+{
+  struct stat st;
+  if (::stat((path + ".ridx").c_str(), &st) != 0) return 0;
+  auto in = open_input(path + ".ridx");
+  std::string line;
+  if (!in->getline(line) || line.rfind("#ridx\t", 0) != 0) return 0;
+  std::size_t rows = 0;
+  while (in->getline(line)) rows += !line.empty();
+  return rows;
+}
+
+// Data rows of a text output: its non-blank lines, less the header.
+static std::size_t count_text_rows(const std::string& path)
+{
+  auto in = open_input(path);
+  std::vector<char> chunk(CHUNK);
+  std::size_t lines = 0;
+  bool        text  = false;   // the current line is not blank
+  for (std::size_t got; (got = in->read(chunk.data(), chunk.size())) > 0; ) {
+    for (std::size_t i = 0; i < got; ++i) {
+      if (chunk[i] == '\n') { lines += text; text = false; }
+      else if (!std::isspace(static_cast<unsigned char>(chunk[i]))) text = true;
+    }
+  }
+  lines += text;
+  return lines > 0 ? lines - 1 : 0;
+}
+
+CombinedMatrix reduce_outputs(const std::vector<std::string>& paths,
+                              const CombineOptions&           opts)
+{
+  if (paths.empty()) throw std::runtime_error("No input files specified");
+  std::vector<std::unique_ptr<MatrixReader>> in(paths.size());
+  parallel_for(paths.size(), opts.threads, [&](std::size_t i) {
+    in[i] = std::make_unique<MatrixReader>(paths[i]);
+  });
+
+  // the reference: a binary input if there is one, its row count known
+  std::size_t ref = 0;
+  for (std::size_t i = 0; i < in.size(); ++i)
+    if (in[i]->nrows() > 0) { ref = i; break; }
+  for (const auto& r : in) {
+    if (r->type() != in[ref]->type())
+      throw std::runtime_error(r->path() + " has ID label " + id_label(r->type()) + ", " +
+                               in[ref]->path() + " has " + id_label(in[ref]->type()));
+    const NameTable& a = r->cols();
+    const NameTable& b = in[ref]->cols();
+    bool same = a.size() == b.size();
+    for (std::size_t c = 0; same && c < a.size(); ++c) same = a[c] == b[c];
+    if (!same)
+      throw std::runtime_error(r->path() + " has different columns from " + in[ref]->path());
+  }
+
+  CombinedMatrix m;
+  m.type     = in[ref]->type();
+  m.colNames = in[ref]->cols();
+  m.ncols    = m.colNames.size();
+  m.nfiles   = paths.size();
+  if (m.ncols == 0) throw std::runtime_error(in[ref]->path() + " has no columns");
+
+  /* ---- the reference is read into the result as it is ----------------- */
+  const auto t0 = std::chrono::steady_clock::now();
+  const std::size_t per = std::max<std::size_t>(1, REDUCE_BATCH / (m.ncols * sizeof(float)));
+  // The row count is needed up front so the matrix is allocated once and
+  // read straight into.  Text only: it comes from the row index of any
+  // input that has one; failing that, the reference is counted in a first
+  // pass, which inflates it twice (the price of not growing the matrix, at
+  // 2-3x its size, while it is read).
+  m.nrows = in[ref]->nrows();
+  std::string counted = in[ref]->path() + ".json";
+  for (std::size_t i = 0; m.nrows == 0 && i < in.size(); ++i) {
+    m.nrows = indexed_text_rows(paths[i]);
+    counted = paths[i] + ".ridx";
+  }
+  if (m.nrows == 0) {
+    LOG("No input has a row count, counting the rows of " << in[ref]->path());
+    m.nrows = count_text_rows(paths[ref]);
+    counted = "a first pass over it";
+  }
+  if (m.nrows == 0) throw std::runtime_error(in[ref]->path() + " has no rows");
+  m.total = alloc_matrix(m.nrows, m.ncols, opts.hugePages);
+  std::size_t r = 0;
+  for (std::size_t k; r < m.nrows; r += k)
+    if ((k = in[ref]->read_rows(m.total.data() + r * m.ncols,
+                                std::min(per, m.nrows - r), m.rowNames)) == 0) break;
+  std::vector<float> extra(m.ncols);
+  NameTable          extraName;
+  if (r < m.nrows || in[ref]->read_rows(extra.data(), 1, extraName) > 0)
+    throw std::runtime_error(in[ref]->path() + " has " + (r < m.nrows ? std::to_string(r) : "more") +
+                             " rows, not the " + std::to_string(m.nrows) + " given by " + counted);
+  LOG(paths.size() << " combined outputs of " << m.nrows << " rows × " << m.ncols << " cols"
+      << " (" << add_row_kernel() << " row kernel)");
+
+  /* ---- the others, dealt to the workers -------------------------------- */
+  std::vector<std::size_t> rest;
+  for (std::size_t i = 0; i < in.size(); ++i)
+    if (i != ref) rest.push_back(i);
+  const unsigned nthreads = static_cast<unsigned>(
+      std::max<std::size_t>(1, std::min<std::size_t>(opts.threads, rest.size())));
+
+  // slot 0 is the result, slot t > 0 worker t's partial
+  std::vector<AccumBuffer> partial(nthreads - 1);
+  for (auto& p : partial) p = alloc_matrix(m.nrows, m.ncols, opts.hugePages);
+  auto slot = [&](std::size_t t) { return t == 0 ? m.total.data() : partial[t - 1].data(); };
+
+  std::atomic<std::size_t> next{0};
+  run_workers(nthreads, opts.numa, [&](unsigned t) {
+    std::vector<float> buf;
+    for (std::size_t i; (i = next.fetch_add(1)) < rest.size(); ) {
+      add_output(*in[rest[i]], slot(t), m.rowNames, m.ncols, buf);
+      in[rest[i]].reset();
+    }
+  });
+
+  /* ---- fold the partials pairwise: 1 into 0, 3 into 2, ... then 2 into
+     0, and so on; each level's pairs are split into row chunks --------- */
+  const std::size_t chunk = std::max<std::size_t>(1, REDUCE_BATCH / (m.ncols * sizeof(float)));
+  const std::size_t chunks = (m.nrows + chunk - 1) / chunk;
+  for (std::size_t step = 1; step < nthreads; step *= 2) {
+    const std::size_t pairs = (nthreads - step + 2 * step - 1) / (2 * step);
+    parallel_for(pairs * chunks, nthreads, [&](std::size_t j) {
+      const std::size_t to = (j / chunks) * 2 * step;
+      const std::size_t r0 = (j % chunks) * chunk;
+      const std::size_t n  = std::min(chunk, m.nrows - r0) * m.ncols;
+      add_row(slot(to) + r0 * m.ncols, slot(to + step) + r0 * m.ncols, n);
+    });
+  }
+  LOG("Reduction took " << std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - t0).count() << " s");
+  return m;
+}
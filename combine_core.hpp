@@ -0,0 +1,248 @@
+#pragma once
+
+#include <chrono>      // timestamps for logging
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "accum_buffer.hpp"
+#include "inputs.hpp"
+#include "name_table.hpp"
+
+/*
+------------------------------------------------------------------------------
+ Core of combine_chunklengths, shared by the command-line tool and the
+ Python module.
+ - Input type / ID column handling
+ - Matrix layout discovery from the first input file
+ - Streaming accumulation of any number of inputs into one float matrix
+ Errors are reported by throwing std::runtime_error; the CLI prints them and
+ exits, the Python module turns them into RuntimeError.
+------------------------------------------------------------------------------
+*/
+
+#define LOG(msg)                                                             \
+  do {                                                                       \
+    using clk = std::chrono::system_clock;                                   \
+    auto  now = clk::to_time_t(clk::now());                                  \
+    std::cout << std::put_time(std::localtime(&now), "%F %T") << "  " << msg \
+              << std::endl;                                                  \
+  } while (0)
+
+enum class InputType { Pbwt, ChromoPainter, SparsePainter };
+
+// "pbwt", "chromopainter" or "SparsePainter"; returns false on anything else
+bool parse_input_type(const std::string& s, InputType& type);
+
+// header label of the ID column ("RECIPIENT", "Recipient", "indnames")
+const char* id_label(InputType type);
+
+/* -------------------------------------------------------------------------
+   Matrix layout, taken from the header (and for SparsePainter the ID
+   column) of the first input file
+   --------------------------------------------------------------------- */
+struct MatrixLayout {
+  int                      removeIndex = -1;  // position of the ID column
+  NameTable                colNames;
+  NameTable                rowNames;
+  std::size_t              nrows = 0;
+  std::size_t              ncols = 0;
+};
+
+MatrixLayout discover_layout(const std::string& firstFile, InputType type);
+
+/* -------------------------------------------------------------------------
+   Header pre-flight: only the first line of every file is read
+   --------------------------------------------------------------------- */
+struct HeaderInfo {
+  int           removeIndex = -1;
+  std::size_t   ncols       = 0;
+  std::uint64_t colHash     = 0;   // FNV-1a over the column names, in order
+  std::uint64_t colSetHash  = 0;   // same names in any order hash the same
+};
+
+HeaderInfo read_header_info(const std::string& file, InputType type);
+
+enum class HeaderMatch {
+  Exact,      // ID column in the same place, same column names in order
+  AnyOrder,   // same set of column names, ID column anywhere
+  IdOnly      // just an ID column (union mode)
+};
+
+// Check, `threads` files at a time, every file's header against files[0];
+// throws listing every offending file.
+void validate_headers(const std::vector<InputFile>& files, InputType type,
+                      unsigned threads, HeaderMatch match = HeaderMatch::Exact);
+
+/* -------------------------------------------------------------------------
+   Combined result.  `total` is row-major nrows × ncols.
+   --------------------------------------------------------------------- */
+struct CombinedMatrix {
+  InputType                type = InputType::Pbwt;
+  NameTable                rowNames;
+  NameTable                colNames;
+  std::size_t              nrows = 0;
+  std::size_t              ncols = 0;
+  AccumBuffer              total;
+  std::size_t              nfiles = 0;
+
+  // Union mode only: bit f of rowFiles[r * maskWords + f / 64] is set when
+  // input f has row r, likewise colFiles for columns.
+  std::size_t                maskWords = 0;
+  std::vector<std::uint64_t> rowFiles, colFiles;
+
+  // Row band only (CombineOptions::rows): these are rows [firstRow,
+  // firstRow + nrows) of a full result of fullRows rows (0: not a band).
+  std::size_t firstRow = 0, fullRows = 0;
+
+  // number of inputs that contributed to cell (r, c)
+  std::uint32_t present(std::size_t r, std::size_t c) const;
+};
+
+/* -------------------------------------------------------------------------
+   Row bands: keep only some rows of the result, so one big combine can be
+   spread over many jobs, each holding just its band, and the band outputs
+   joined afterwards (merge_bands() in matrix_io.hpp).  Rows are numbered
+   from 0 in the result's order.
+   --------------------------------------------------------------------- */
+struct RowRange {
+  std::size_t begin = 0, end = SIZE_MAX;   // rows [begin, end) ...
+  unsigned    shard = 0, shards = 0;       // ... or band `shard` of `shards` equal ones
+
+  bool whole() const { return shards == 0 && begin == 0 && end == SIZE_MAX; }
+
+  // [first, last) out of `nrows`; throws if that is empty
+  std::pair<std::size_t, std::size_t> resolve(std::size_t nrows) const;
+};
+
+// "START:END" (END exclusive, either may be left out) and "i/n" (0 <= i < n);
+// return false on anything else
+bool parse_row_range(const std::string& s, RowRange& r);
+bool parse_shard(const std::string& s, RowRange& r);
+
+struct CombineOptions {
+  InputType type    = InputType::Pbwt;
+  unsigned  threads = 1;   // files are spread over this many workers
+  bool      validate = true;   // run validate_headers() before allocating
+
+  HugePages hugePages = HugePages::Off;   // for the result and the partials
+  bool      numa      = false;   // pin workers to nodes, first-touch bands
+
+  // > 0: keep a single copy of the matrix split into this many row bands,
+  // each owned by one accumulator thread; the `threads` workers only parse
+  // and hand rows to the owners.  Memory stays 1× whatever the thread count.
+  unsigned  bands     = 0;
+
+  // With threads > 1, BGZF inputs are cut into work units of about this
+  // many compressed bytes (0: whole files only).  Idle workers steal units
+  // from the busiest queue, so one big chromosome no longer runs alone at
+  // the end.  Plain gzip inputs are split too once index_inputs() has built
+  // their .zidx.  Positional BGZF splits only along a .ridx row index.
+  std::uint64_t splitBytes = std::uint64_t{64} << 20;
+
+  // Read the next two files into the page cache in the background while
+  // the current ones are parsed, holding at most this many bytes ahead
+  // (0: off).  See prefetch.hpp.
+  std::uint64_t prefetchBytes = std::uint64_t{256} << 20;
+
+  // Match rows and columns by name instead of by position.  The master
+  // order is the first file's, or the IDs listed in `masterIds` (one per
+  // line; for pbwt / chromopainter it orders the rows as well).
+  bool        align = false;
+  std::string masterIds;       // implies align
+
+  // Sum over the union of all rows / columns seen in any input (implies
+  // align; a master list is not used).  Cells missing from a file get no
+  // contribution from it, and CombinedMatrix records which inputs had what.
+  bool unionIds = false;
+
+  // only these rows are allocated, parsed and returned; the rest of every
+  // input is still read through (to count its rows) but not parsed
+  RowRange rows;
+
+  // Extra sums over subsets of the inputs (indices into the file list),
+  // e.g. odd and even chromosomes: each row parsed is added into the total
+  // and into every group matrix its input is in, so k groups cost k more
+  // matrices of memory (per thread, unless `bands`) but no more parsing.
+  std::vector<std::vector<std::size_t>> groups;
+};
+
+HeaderMatch header_match(const CombineOptions& opts);
+
+// Leave-one-out (jackknife) results: the total without each input in turn.
+class LeaveOneOutput {
+public:
+  virtual ~LeaveOneOutput() = default;
+  // the result without input f (union masks and nfiles adjusted to match);
+  // called from several workers at once, each passing its own `m`, which
+  // may be modified and is overwritten for the worker's next input
+  virtual void write(std::size_t f, CombinedMatrix& m) = 0;
+};
+
+// Sum all `files` element-wise (each scaled by its weight); the layout comes
+// from files[0].  With threads > 1 each worker takes work units (see
+// splitBytes), largest files first, and accumulates into a private
+// nrows × ncols partial which is added into the result at the end (memory
+// grows with the thread count), unless `bands` is set.
+// With `jackknife`, a second pass then reads each input once more: up to
+// `threads` workers each copy the total into a matrix of their own,
+// subtract one input from it and hand it to jackknife->write().  Every
+// input must be a regular file.
+// With `groupSums`, the sums over opts.groups are appended to it, in order
+// (opts.groups is ignored without it).
+CombinedMatrix combine_files(std::vector<InputFile>       files,
+                             const CombineOptions&        opts,
+                             LeaveOneOutput*              jackknife = nullptr,
+                             std::vector<CombinedMatrix>* groupSums = nullptr);
+
+/* -------------------------------------------------------------------------
+   Lockstep row merge.  When every input has the same row order, row r of
+   the result only needs row r of each file: all files are opened at once
+   and read together a batch of rows at a time, and each summed batch goes
+   straight to a RowOutput.  The matrix is never allocated; memory is a few
+   rows per worker.
+   --------------------------------------------------------------------- */
+class RowOutput {
+public:
+  virtual ~RowOutput() = default;
+  // names, type and shape of what follows (`total` is left empty)
+  virtual void begin(const CombinedMatrix& shape) = 0;
+  // the next n rows, row-major n × ncols
+  virtual void write_rows(const float* values, std::size_t n) = 0;
+  virtual void end() = 0;
+};
+
+// Positional inputs only (no align / master list / union).  `threads`
+// workers, started once, take the files of each batch one at a time and
+// parse them into their own batch buffer; `mean` divides by the number of
+// inputs as mean_over_present() would.
+void combine_lockstep(std::vector<InputFile> files, const CombineOptions& opts,
+                      RowOutput& out, bool mean = false);
+
+// Build the .zidx random-access index (see gz_index.hpp) of every plain
+// gzip input, `threads` files at a time, with an access point about every
+// `spacing` uncompressed bytes.  BGZF inputs need none and are skipped.
+void index_inputs(const std::vector<InputFile>& files, unsigned threads,
+                  std::uint64_t spacing);
+
+/* -------------------------------------------------------------------------
+   Reduction of combined outputs.  Results of earlier runs (per batch of
+   chromosomes, per chunk of samples) summed into one, in any mix of the
+   output formats write_matrix() writes; binary ones are read as stored,
+   with no text parse.  All must have the same ID label and columns, and
+   the same rows in the same order.
+   --------------------------------------------------------------------- */
+// Inputs are dealt to `threads` workers, each summing its share into a
+// private partial (memory grows with the thread count); the partials are
+// then added pairwise, level by level, into the result.
+CombinedMatrix reduce_outputs(const std::vector<std::string>& paths,
+                              const CombineOptions&           opts);
+
+// Divide every cell by the number of inputs that contributed to it, i.e.
+// the mean over the chromosomes actually present (cells nobody had stay 0).
+void mean_over_present(CombinedMatrix& m);
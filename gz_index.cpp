@@ -0,0 +1,310 @@
+#include "gz_index.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+
+constexpr char          MAGIC[4]  = {'Z', 'I', 'D', 'X'};
+constexpr std::uint32_t VERSION   = 1;
+constexpr std::size_t   HEAD_SZ   = 40;   // magic, version, size, mtime, spacing, count
+constexpr std::size_t   RECORD_SZ = 40;   // out, in, lines, windowAt, bits, prev, pad
+constexpr std::size_t   IN_CHUNK  = 1 << 18;
+
+void put_u64(std::string& b, std::uint64_t v)
+{
+  for (int i = 0; i < 8; ++i) b += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+void put_u32(std::string& b, std::uint32_t v)
+{
+  for (int i = 0; i < 4; ++i) b += static_cast<char>((v >> (8 * i)) & 0xff);
+}
+std::uint64_t get_u64(const unsigned char* p)
+{
+  std::uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+std::uint32_t get_u32(const unsigned char* p)
+{
+  return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) |
+         (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+bool file_stamp(const std::string& path, std::uint64_t& bytes, std::int64_t& mtime)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) return false;
+  bytes = static_cast<std::uint64_t>(st.st_size);
+  mtime = static_cast<std::int64_t>(st.st_mtime);
+  return true;
+}
+
+using FilePtr = std::unique_ptr<std::FILE, int (*)(std::FILE*)>;
+
+FilePtr open_file(const std::string& path, const char* mode)
+{
+  return FilePtr(std::fopen(path.c_str(), mode), std::fclose);
+}
+
+} // namespace
+
+std::string gz_index_path(const std::string& path) { return path + ".zidx"; }
+
+/* -------------------------------------------------------------------------
+   Building
+   --------------------------------------------------------------------- */
+GzIndex build_gz_index(const std::string& path, std::uint64_t spacing)
+{
+  GzIndex idx;
+  idx.path = path;
+  if (!file_stamp(path, idx.fileBytes, idx.mtime))
+    throw std::runtime_error("Cannot stat " + path);
+  FilePtr fh = open_file(path, "rb");
+  if (!fh) throw std::runtime_error("Cannot open " + path);
+
+  z_stream zs{};
+  if (inflateInit2(&zs, 47) != Z_OK)   // 15-bit window, gzip or zlib header
+    throw std::runtime_error("inflateInit2 failed for " + path);
+  std::unique_ptr<z_stream, int (*)(z_stream*)> guard(&zs, inflateEnd);
+
+  std::vector<unsigned char> in(IN_CHUNK), window(GZ_WINDOW);
+  std::vector<std::vector<unsigned char>> windows;
+  std::uint64_t totin = 0, totout = 0, last = 0, lines = 0;
+  int ret = Z_OK;
+
+  while (true) {
+    if (zs.avail_in == 0) {
+      const std::size_t got = std::fread(in.data(), 1, in.size(), fh.get());
+      if (got == 0) break;
+      zs.avail_in = static_cast<uInt>(got);
+      zs.next_in  = in.data();
+    }
+    if (ret == Z_STREAM_END) {
+      if (zs.next_in[0] != 0x1f) break;   // trailing padding after the last member
+      inflateReset(&zs);
+    }
+    if (zs.avail_out == 0) {   // the window is a ring over the output
+      zs.avail_out = GZ_WINDOW;
+      zs.next_out  = window.data();
+    }
+
+    const unsigned char* before = zs.next_out;
+    totin  += zs.avail_in;
+    totout += zs.avail_out;
+    ret = inflate(&zs, Z_BLOCK);   // stop at every deflate block boundary
+    totin  -= zs.avail_in;
+    totout -= zs.avail_out;
+    lines  += static_cast<std::uint64_t>(std::count(before, const_cast<const unsigned char*>(zs.next_out), '\n'));
+    if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+      throw std::runtime_error("Corrupt gzip data in " + path);
+
+    // bit 7: at a block boundary; bit 6: that was the last block
+    if (ret != Z_STREAM_END && (zs.data_type & 128) && !(zs.data_type & 64) &&
+        totout >= GZ_WINDOW && totout - last >= spacing) {
+      GzAccessPoint p;
+      p.out   = totout;
+      p.in    = totin;
+      p.bits  = zs.data_type & 7;
+      p.lines = lines;
+      std::vector<unsigned char> w(GZ_WINDOW);
+      const std::size_t left = zs.avail_out;   // oldest bytes are the ring's tail
+      std::memcpy(w.data(), window.data() + GZ_WINDOW - left, left);
+      std::memcpy(w.data() + left, window.data(), GZ_WINDOW - left);
+      p.prev = static_cast<char>(w.back());
+      idx.points.push_back(p);
+      windows.push_back(std::move(w));
+      last = totout;
+    }
+  }
+  if (ret != Z_STREAM_END) throw std::runtime_error("Truncated gzip file " + path);
+
+  /* ---- write <path>.zidx (to a temporary, then renamed into place) ---- */
+  std::string head(MAGIC, sizeof MAGIC);
+  put_u32(head, VERSION);
+  put_u64(head, idx.fileBytes);
+  put_u64(head, static_cast<std::uint64_t>(idx.mtime));
+  put_u64(head, spacing);
+  put_u64(head, idx.points.size());
+  for (std::size_t k = 0; k < idx.points.size(); ++k) {
+    GzAccessPoint& p = idx.points[k];
+    p.windowAt = HEAD_SZ + idx.points.size() * RECORD_SZ + k * GZ_WINDOW;
+    put_u64(head, p.out);
+    put_u64(head, p.in);
+    put_u64(head, p.lines);
+    put_u64(head, p.windowAt);
+    put_u32(head, static_cast<std::uint32_t>(p.bits));
+    head += p.prev;
+    head.append(3, '\0');
+  }
+
+  const std::string dst = gz_index_path(path), tmp = dst + ".tmp";
+  FilePtr out = open_file(tmp, "wb");
+  if (!out) throw std::runtime_error("Cannot create " + tmp);
+  bool ok = std::fwrite(head.data(), 1, head.size(), out.get()) == head.size();
+  for (const auto& w : windows)
+    ok = ok && std::fwrite(w.data(), 1, w.size(), out.get()) == w.size();
+  ok = std::fclose(out.release()) == 0 && ok;
+  if (!ok || std::rename(tmp.c_str(), dst.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Write error on " + dst);
+  }
+  return idx;
+}
+
+/* -------------------------------------------------------------------------
+   Loading
+   --------------------------------------------------------------------- */
+bool load_gz_index(const std::string& path, GzIndex& idx)
+{
+  FilePtr fh = open_file(gz_index_path(path), "rb");
+  if (!fh) return false;
+
+  unsigned char h[HEAD_SZ];
+  if (std::fread(h, 1, HEAD_SZ, fh.get()) != HEAD_SZ ||
+      std::memcmp(h, MAGIC, sizeof MAGIC) != 0 || get_u32(h + 4) != VERSION)
+    return false;
+
+  GzIndex out;
+  out.path = path;
+  if (!file_stamp(path, out.fileBytes, out.mtime) ||
+      get_u64(h + 8) != out.fileBytes ||
+      static_cast<std::int64_t>(get_u64(h + 16)) != out.mtime)
+    return false;   // stale: the gzip file changed since it was indexed
+
+  const std::uint64_t n = get_u64(h + 32);
+  std::vector<unsigned char> rec(RECORD_SZ);
+  for (std::uint64_t k = 0; k < n; ++k) {
+    if (std::fread(rec.data(), 1, RECORD_SZ, fh.get()) != RECORD_SZ) return false;
+    GzAccessPoint p;
+    p.out      = get_u64(rec.data());
+    p.in       = get_u64(rec.data() + 8);
+    p.lines    = get_u64(rec.data() + 16);
+    p.windowAt = get_u64(rec.data() + 24);
+    p.bits     = static_cast<int>(get_u32(rec.data() + 32));
+    p.prev     = static_cast<char>(rec[36]);
+    out.points.push_back(p);
+  }
+  idx = std::move(out);
+  return true;
+}
+
+/* -------------------------------------------------------------------------
+   Reading from an access point
+   --------------------------------------------------------------------- */
+GzRangeReader::GzRangeReader(const GzIndex& index, const GzAccessPoint* from)
+  : path_(index.path), in_(IN_CHUNK), buf_(1 << 20)
+{
+  next_ = end_ = buf_.data();
+  fh_ = std::fopen(path_.c_str(), "rb");
+  if (!fh_) throw std::runtime_error("Cannot open " + path_);
+
+  if (!from) {
+    if (inflateInit2(&zs_, 47) != Z_OK) {
+      std::fclose(fh_);
+      throw std::runtime_error("inflateInit2 failed for " + path_);
+    }
+    return;
+  }
+
+  std::vector<unsigned char> window(GZ_WINDOW);
+  {
+    FilePtr ih = open_file(gz_index_path(path_), "rb");
+    if (!ih || fseeko(ih.get(), static_cast<off_t>(from->windowAt), SEEK_SET) != 0 ||
+        std::fread(window.data(), 1, GZ_WINDOW, ih.get()) != GZ_WINDOW) {
+      std::fclose(fh_);
+      throw std::runtime_error("Cannot read " + gz_index_path(path_));
+    }
+  }
+  raw_ = true;
+  pos_ = from->out;
+  int c = 0;
+  const bool ok =
+      fseeko(fh_, static_cast<off_t>(from->in - (from->bits ? 1 : 0)), SEEK_SET) == 0 &&
+      (!from->bits || (c = std::fgetc(fh_)) != EOF) &&
+      inflateInit2(&zs_, -15) == Z_OK;
+  if (!ok) {
+    std::fclose(fh_);
+    throw std::runtime_error("Cannot seek in " + path_);
+  }
+  if (from->bits) inflatePrime(&zs_, from->bits, c >> (8 - from->bits));
+  inflateSetDictionary(&zs_, window.data(), GZ_WINDOW);
+}
+
+GzRangeReader::~GzRangeReader()
+{
+  inflateEnd(&zs_);
+  if (fh_) std::fclose(fh_);
+}
+
+bool GzRangeReader::fill()
+{
+  if (done_) return false;
+  pos_ += static_cast<std::uint64_t>(end_ - buf_.data());
+  zs_.next_out  = reinterpret_cast<Bytef*>(buf_.data());
+  zs_.avail_out = static_cast<uInt>(buf_.size());
+
+  auto more_input = [&]() {
+    if (zs_.avail_in) return true;
+    const std::size_t got = std::fread(in_.data(), 1, in_.size(), fh_);
+    zs_.next_in  = in_.data();
+    zs_.avail_in = static_cast<uInt>(got);
+    return got > 0;
+  };
+
+  bool atMemberEnd = false;
+  while (zs_.avail_out > 0) {
+    if (!more_input()) {
+      if (!atMemberEnd) throw std::runtime_error("Truncated gzip file " + path_);
+      done_ = true;
+      break;
+    }
+    if (atMemberEnd) {
+      if (zs_.next_in[0] != 0x1f) { done_ = true; break; }   // trailing padding
+      atMemberEnd = false;
+    }
+    const int ret = inflate(&zs_, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      if (raw_) {
+        // began mid-member without the gzip framing: skip its trailer
+        for (int skip = 8; skip > 0; ) {
+          if (!more_input()) throw std::runtime_error("Truncated gzip file " + path_);
+          const uInt k = std::min<uInt>(zs_.avail_in, static_cast<uInt>(skip));
+          zs_.next_in += k; zs_.avail_in -= k; skip -= static_cast<int>(k);
+        }
+        raw_ = false;
+        inflateReset2(&zs_, 31);
+      } else {
+        inflateReset(&zs_);
+      }
+      atMemberEnd = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      throw std::runtime_error("Corrupt gzip data in " + path_);
+    }
+  }
+  next_ = buf_.data();
+  end_  = buf_.data() + (buf_.size() - zs_.avail_out);
+  return end_ > next_;
+}
+
+bool GzRangeReader::getline(std::string& line)
+{
+  line.clear();
+  bool any = false;
+  while (true) {
+    if (next_ == end_ && !fill()) return any;
+    any = true;
+    char* nl = static_cast<char*>(std::memchr(next_, '\n', static_cast<std::size_t>(end_ - next_)));
+    if (nl) {
+      line.append(next_, nl);
+      next_ = nl + 1;
+      return true;
+    }
+    line.append(next_, end_);
+    next_ = end_;
+  }
+}
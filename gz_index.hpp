@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/*
+------------------------------------------------------------------------------
+ Random access into plain (single- or multi-member) gzip files, after
+ zlib's examples/zran.c.  One sequential pass records an access point every
+ `spacing` uncompressed bytes at a deflate block boundary: where the block
+ starts in both streams, the 32 KiB of output before it (the dictionary a
+ fresh inflater needs) and how many lines came before it.  The index is
+ cached as <file>.zidx and later runs inflate from several points at once.
+------------------------------------------------------------------------------
+*/
+
+constexpr std::size_t GZ_WINDOW = 32768;
+
+struct GzAccessPoint {
+  std::uint64_t out   = 0;   // uncompressed offset
+  std::uint64_t in    = 0;   // compressed offset of the first whole byte
+  int           bits  = 0;   // bits of the byte before `in` that belong here
+  std::uint64_t lines = 0;   // newlines in [0, out)
+  char          prev  = 0;   // the byte at out - 1
+  std::uint64_t windowAt = 0;   // where its window is stored in the .zidx
+};
+
+struct GzIndex {
+  std::string                path;       // the gzip file
+  std::uint64_t              fileBytes = 0;
+  std::int64_t               mtime     = 0;
+  std::vector<GzAccessPoint> points;     // ascending, none at offset 0
+};
+
+// <path>.zidx
+std::string gz_index_path(const std::string& path);
+
+// Inflate `path` once and write <path>.zidx with a point about every
+// `spacing` uncompressed bytes.  Throws on corrupt input or I/O errors.
+GzIndex build_gz_index(const std::string& path, std::uint64_t spacing);
+
+// Read <path>.zidx; false if there is none or it no longer matches the
+// file's size and modification time.
+bool load_gz_index(const std::string& path, GzIndex& index);
+
+// Inflates `path` from the start, or from one access point of its index,
+// and hands out lines.  tell() is the uncompressed offset of the next byte.
+class GzRangeReader {
+public:
+  GzRangeReader(const GzIndex& index, const GzAccessPoint* from);
+  ~GzRangeReader();
+  GzRangeReader(const GzRangeReader&)            = delete;
+  GzRangeReader& operator=(const GzRangeReader&) = delete;
+
+  // read one line (newline stripped); false at end of file
+  bool getline(std::string& line);
+
+  std::uint64_t tell() const { return pos_ + (next_ - buf_.data()); }
+
+private:
+  bool fill();   // inflate more into buf_; false at end of file
+
+  std::string       path_;
+  std::FILE*        fh_ = nullptr;
+  z_stream          zs_{};
+  bool              raw_ = false;   // started mid-member: no gzip framing yet
+  bool              done_ = false;
+  std::vector<unsigned char> in_;
+  std::vector<char> buf_;
+  char*             next_ = nullptr;   // unread part of buf_: [next_, end_)
+  char*             end_  = nullptr;
+  std::uint64_t     pos_  = 0;         // offset of buf_[0]
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+/*
+------------------------------------------------------------------------------
+ Idle workers helping busy ones.  A fixed set of member threads each do
+ their own work; a member with nothing left calls help() and from then on
+ runs pieces of the loops the others post with run(), until every member
+ is done.  A poster always works through its own loop too, so nothing ever
+ waits on a helper; idle() tells it whether splitting is worth it at all.
+ Pieces are coarse (a segment of a multi-megabyte line), so one mutex for
+ the whole pool is plenty.
+------------------------------------------------------------------------------
+*/
+
+class HelperPool {
+public:
+  explicit HelperPool(unsigned members) : members_(members), active_(members) {}
+  HelperPool(const HelperPool&)            = delete;
+  HelperPool& operator=(const HelperPool&) = delete;
+
+  unsigned members() const { return members_; }
+
+  // members waiting in help() right now (a hint, not a promise)
+  unsigned idle() const
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    return idle_;
+  }
+
+  // this member has no work of its own left (also on failure)
+  void retire()
+  {
+    { std::lock_guard<std::mutex> lk(mu_); --active_; }
+    work_.notify_all();
+  }
+
+  // retire, then run posted pieces until every member has retired
+  void help()
+  {
+    std::unique_lock<std::mutex> lk(mu_);
+    --active_;
+    ++idle_;
+    work_.notify_all();
+    while (true) {
+      work_.wait(lk, [&] { return !jobs_.empty() || active_ == 0; });
+      if (jobs_.empty()) break;
+      Job* job = jobs_.front();
+      const std::size_t i = claim(*job);
+      --idle_;
+      lk.unlock();
+      execute(*job, i);
+      lk.lock();
+      ++idle_;
+    }
+    --idle_;
+  }
+
+  // fn(i) for every i < n, on this thread and any helpers; returns once all
+  // are done and rethrows the first exception one of them threw
+  template <class Fn>
+  void run(std::size_t n, Fn&& fn)
+  {
+    if (n == 0) return;
+    const std::function<void(std::size_t)> body = std::ref(fn);
+    Job job;
+    job.fn = &body;
+    job.n  = n;
+    { std::lock_guard<std::mutex> lk(mu_); jobs_.push_back(&job); }
+    work_.notify_all();
+
+    while (true) {
+      std::size_t i;
+      {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (job.next == n) break;
+        i = claim(job);
+      }
+      execute(job, i);
+    }
+    std::unique_lock<std::mutex> lk(mu_);
+    done_.wait(lk, [&] { return job.done == n; });
+    if (job.failure) std::rethrow_exception(job.failure);
+  }
+
+private:
+  struct Job {
+    const std::function<void(std::size_t)>* fn = nullptr;
+    std::size_t        n    = 0;
+    std::size_t        next = 0, done = 0;   // under mu_
+    std::exception_ptr failure;
+  };
+
+  // the next piece of `job`; unlists it once the last one is taken (mu_ held)
+  std::size_t claim(Job& job)
+  {
+    const std::size_t i = job.next++;
+    if (job.next == job.n) jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+    return i;
+  }
+
+  // after the final ++done the poster may return: `job` is not touched again
+  void execute(Job& job, std::size_t i)
+  {
+    std::exception_ptr failure;
+    try {
+      (*job.fn)(i);
+    } catch (...) {
+      failure = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      if (failure && !job.failure) job.failure = failure;
+      ++job.done;
+    }
+    done_.notify_all();
+  }
+
+  const unsigned          members_;
+  mutable std::mutex      mu_;
+  std::condition_variable work_, done_;
+  std::deque<Job*>        jobs_;
+  unsigned                active_;
+  unsigned                idle_ = 0;
+};
@@ -0,0 +1,583 @@
+#include "input_stream.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "bgzf.hpp"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace {
+
+constexpr std::size_t READ_AHEAD = 1 << 16;   // getline() refill size
+constexpr std::size_t IN_CHUNK   = 1 << 18;   // compressed bytes per read
+
+std::uint32_t get_le32(const unsigned char* p)
+{
+  return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) |
+         (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+constexpr std::uint32_t ZSTD_MAGIC      = 0xFD2FB528u;
+constexpr std::uint32_t LZ4_MAGIC       = 0x184D2204u;
+constexpr std::uint32_t SKIPPABLE_MASK  = 0xFFFFFFF0u;   // zstd / lz4 skippable frames
+constexpr std::uint32_t SKIPPABLE_MAGIC = 0x184D2A50u;
+constexpr std::uint32_t SEEKABLE_MAGIC  = 0x8F92EAB1u;
+
+// format from the first `got` bytes of a file (BGZF shows up as gzip)
+Compression sniff(const unsigned char* m, std::size_t got)
+{
+  if (got >= 2 && m[0] == 0x1f && m[1] == 0x8b) return Compression::Gzip;
+  if (got < 4) return Compression::None;
+  const std::uint32_t magic = get_le32(m);
+  if (magic == ZSTD_MAGIC || (magic & SKIPPABLE_MASK) == SKIPPABLE_MAGIC) return Compression::Zstd;
+  if (magic == LZ4_MAGIC) return Compression::Lz4;
+  return Compression::None;
+}
+
+// read(2) that retries on EINTR; 0 at end of input
+std::size_t read_fd(int fd, void* buf, std::size_t n, const std::string& path)
+{
+  while (true) {
+    const ssize_t got = ::read(fd, buf, n);
+    if (got >= 0) return static_cast<std::size_t>(got);
+    if (errno != EINTR) throw std::runtime_error("Read error in " + path + ": " + std::strerror(errno));
+  }
+}
+
+/* ---- gzip and BGZF (gzread also passes plain text through) ------------ */
+class GzipStream : public InputStream {
+public:
+  explicit GzipStream(const std::string& path) : InputStream(path)
+  {
+    gz_ = gzopen(path.c_str(), "rb");
+    if (!gz_) throw std::runtime_error("Cannot open " + path);
+    gzbuffer(gz_, 1 << 17);
+  }
+  ~GzipStream() override { gzclose(gz_); }
+
+  std::uint64_t compressed_offset() const override
+  {
+    return static_cast<std::uint64_t>(gzoffset(gz_));
+  }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    const unsigned want = static_cast<unsigned>(std::min<std::size_t>(n, 1u << 30));
+    const int got = gzread(gz_, buf, want);
+    if (got < 0) {
+      int err = 0;
+      throw std::runtime_error("Read error in " + path_ + ": " + gzerror(gz_, &err));
+    }
+    return static_cast<std::size_t>(got);
+  }
+
+private:
+  gzFile gz_ = nullptr;
+};
+
+/* ---- uncompressed ------------------------------------------------------- */
+class PlainStream : public InputStream {
+public:
+  explicit PlainStream(const std::string& path) : InputStream(path)
+  {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) throw std::runtime_error("Cannot open " + path);
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  // a stream whose first bytes (`prefix`) were read to sniff the format
+  PlainStream(const std::string& path, int fd, const std::string& prefix)
+    : InputStream(path), fd_(fd), done_(prefix.size())
+  {
+    preload(prefix);
+  }
+  ~PlainStream() override { ::close(fd_); }
+
+  std::uint64_t compressed_offset() const override { return done_; }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    const std::size_t got = read_fd(fd_, buf, n, path_);
+    done_ += got;
+    return got;
+  }
+
+private:
+  int           fd_   = -1;
+  std::uint64_t done_ = 0;
+};
+
+/* ---- uncompressed, from a read-ahead source --------------------------- */
+class SourceStream : public InputStream {
+public:
+  SourceStream(const std::string& path, std::unique_ptr<ByteSource> src)
+    : InputStream(path), src_(std::move(src)) {}
+
+  std::uint64_t compressed_offset() const override { return done_; }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    if (left_ == 0 && !src_->next(at_, left_)) return 0;
+    const std::size_t k = std::min(n, left_);
+    std::memcpy(buf, at_, k);
+    at_   += k;
+    left_ -= k;
+    done_ += k;
+    return k;
+  }
+
+private:
+  std::unique_ptr<ByteSource> src_;
+  const unsigned char*        at_   = nullptr;   // unread part of the block
+  std::size_t                 left_ = 0;
+  std::uint64_t               done_ = 0;
+};
+
+/* ---- a stream's descriptor, the sniffed bytes first -------------------- */
+class FdSource : public ByteSource {
+public:
+  FdSource(const std::string& path, int fd, const std::string& prefix)
+    : path_(path), fd_(fd), buf_(prefix.begin(), prefix.end()) {}
+  ~FdSource() override { ::close(fd_); }
+
+  bool next(const unsigned char*& data, std::size_t& len) override
+  {
+    if (!started_) {
+      started_ = true;
+      if (!buf_.empty()) { data = buf_.data(); len = buf_.size(); return true; }
+    }
+    buf_.resize(IN_CHUNK);
+    len  = read_fd(fd_, buf_.data(), buf_.size(), path_);
+    data = buf_.data();
+    return len > 0;
+  }
+
+private:
+  std::string                path_;
+  int                        fd_;
+  std::vector<unsigned char> buf_;
+  bool                       started_ = false;
+};
+
+/* ---- gzip and BGZF through inflate(), fed by a ByteSource: streams (gzread
+        can't be handed the sniffed bytes) and the read-ahead backends ------ */
+class InflateStream : public InputStream {
+public:
+  InflateStream(const std::string& path, std::unique_ptr<ByteSource> src)
+    : InputStream(path), src_(std::move(src))
+  {
+    if (inflateInit2(&zs_, 15 + 16) != Z_OK)
+      throw std::runtime_error("Cannot initialise zlib for " + path);
+  }
+  ~InflateStream() override { inflateEnd(&zs_); }
+
+  std::uint64_t compressed_offset() const override { return consumed_ - zs_.avail_in; }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    const uInt want = static_cast<uInt>(std::min<std::size_t>(n, 1u << 30));
+    zs_.next_out  = reinterpret_cast<Bytef*>(buf);
+    zs_.avail_out = want;
+    while (zs_.avail_out == want) {
+      if (zs_.avail_in == 0) {
+        const unsigned char* data = nullptr;
+        std::size_t          got  = 0;
+        if (!src_->next(data, got)) {
+          if (inMember_) throw std::runtime_error("Truncated gzip data in " + path_);
+          break;
+        }
+        consumed_   += got;
+        zs_.next_in  = const_cast<Bytef*>(data);
+        zs_.avail_in = static_cast<uInt>(got);
+      }
+      const int rc = inflate(&zs_, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END) {   // concatenated members (and BGZF) go on
+        inflateReset(&zs_);
+        inMember_ = false;
+        continue;
+      }
+      if (rc != Z_OK && rc != Z_BUF_ERROR)
+        throw std::runtime_error("Corrupt gzip data in " + path_ +
+                                 (zs_.msg ? std::string(": ") + zs_.msg : std::string()));
+      inMember_ = true;
+    }
+    return want - zs_.avail_out;
+  }
+
+private:
+  std::unique_ptr<ByteSource> src_;
+  z_stream                    zs_{};
+  std::uint64_t               consumed_ = 0;
+  bool                        inMember_ = false;
+};
+
+#ifdef HAVE_ZSTD
+/* ---- zstd (any number of frames; skippable frames are ignored) ---------- */
+class ZstdStream : public InputStream {
+public:
+  ZstdStream(const std::string& path, std::uint64_t cOffset = 0, std::uint64_t dOffset = 0)
+    : InputStream(path, dOffset), in_(ZSTD_DStreamInSize()), consumed_(cOffset)
+  {
+    fh_ = std::fopen(path.c_str(), "rb");
+    if (!fh_) throw std::runtime_error("Cannot open " + path);
+    if (cOffset && fseeko(fh_, static_cast<off_t>(cOffset), SEEK_SET) != 0) {
+      std::fclose(fh_);
+      throw std::runtime_error("Seek failed in " + path);
+    }
+    ds_ = ZSTD_createDStream();
+    ZSTD_initDStream(ds_);
+  }
+  // a stream whose first bytes (`prefix`) were read to sniff the format
+  ZstdStream(const std::string& path, int fd, const std::string& prefix)
+    : InputStream(path), in_(std::max(ZSTD_DStreamInSize(), prefix.size())),
+      consumed_(0)
+  {
+    fh_ = ::fdopen(fd, "rb");
+    if (!fh_) { ::close(fd); throw std::runtime_error("Cannot open " + path); }
+    ds_ = ZSTD_createDStream();
+    ZSTD_initDStream(ds_);
+    std::memcpy(in_.data(), prefix.data(), prefix.size());
+    ib_ = {in_.data(), prefix.size(), 0};
+  }
+  ~ZstdStream() override
+  {
+    ZSTD_freeDStream(ds_);
+    std::fclose(fh_);
+  }
+
+  std::uint64_t compressed_offset() const override { return consumed_; }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    ZSTD_outBuffer out{buf, n, 0};
+    while (out.pos == 0) {
+      if (ib_.pos == ib_.size) {
+        const std::size_t got = std::fread(in_.data(), 1, in_.size(), fh_);
+        if (got == 0) {
+          if (hint_ != 0) throw std::runtime_error("Truncated zstd file " + path_);
+          return 0;
+        }
+        ib_ = {in_.data(), got, 0};
+      }
+      const std::size_t before = ib_.pos;
+      hint_ = ZSTD_decompressStream(ds_, &out, &ib_);
+      if (ZSTD_isError(hint_))
+        throw std::runtime_error("Corrupt zstd data in " + path_ + ": " + ZSTD_getErrorName(hint_));
+      consumed_ += ib_.pos - before;
+    }
+    return out.pos;
+  }
+
+private:
+  std::FILE*        fh_ = nullptr;
+  ZSTD_DStream*     ds_ = nullptr;
+  std::vector<char> in_;
+  ZSTD_inBuffer     ib_{nullptr, 0, 0};
+  std::size_t       hint_ = 0;   // 0: between frames
+  std::uint64_t     consumed_;
+};
+#endif
+
+#ifdef HAVE_LZ4
+/* ---- lz4 frame format -------------------------------------------------- */
+class Lz4Stream : public InputStream {
+public:
+  explicit Lz4Stream(const std::string& path) : InputStream(path), in_(IN_CHUNK)
+  {
+    fh_ = std::fopen(path.c_str(), "rb");
+    if (!fh_) throw std::runtime_error("Cannot open " + path);
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx_, LZ4F_VERSION))) {
+      std::fclose(fh_);
+      throw std::runtime_error("Cannot create lz4 context for " + path);
+    }
+  }
+  // a stream whose first bytes (`prefix`) were read to sniff the format
+  Lz4Stream(const std::string& path, int fd, const std::string& prefix)
+    : InputStream(path), in_(IN_CHUNK), len_(prefix.size())
+  {
+    fh_ = ::fdopen(fd, "rb");
+    if (!fh_) { ::close(fd); throw std::runtime_error("Cannot open " + path); }
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx_, LZ4F_VERSION))) {
+      std::fclose(fh_);
+      throw std::runtime_error("Cannot create lz4 context for " + path);
+    }
+    std::memcpy(in_.data(), prefix.data(), prefix.size());
+  }
+  ~Lz4Stream() override
+  {
+    LZ4F_freeDecompressionContext(dctx_);
+    std::fclose(fh_);
+  }
+
+  std::uint64_t compressed_offset() const override { return consumed_; }
+
+protected:
+  std::size_t read_raw(char* buf, std::size_t n) override
+  {
+    std::size_t produced = 0;
+    while (produced == 0) {
+      if (pos_ == len_) {
+        len_ = std::fread(in_.data(), 1, in_.size(), fh_);
+        pos_ = 0;
+        if (len_ == 0) {
+          if (hint_ != 0) throw std::runtime_error("Truncated lz4 file " + path_);
+          return 0;
+        }
+      }
+      std::size_t dst = n, src = len_ - pos_;
+      hint_ = LZ4F_decompress(dctx_, buf, &dst, in_.data() + pos_, &src, nullptr);
+      if (LZ4F_isError(hint_))
+        throw std::runtime_error("Corrupt lz4 data in " + path_ + ": " + LZ4F_getErrorName(hint_));
+      pos_      += src;
+      consumed_ += src;
+      produced   = dst;
+    }
+    return produced;
+  }
+
+private:
+  std::FILE*                fh_   = nullptr;
+  LZ4F_dctx*                dctx_ = nullptr;
+  std::vector<char>         in_;
+  std::size_t               pos_ = 0, len_ = 0;
+  std::size_t               hint_ = 0;   // 0: between frames
+  std::uint64_t             consumed_ = 0;
+};
+#endif
+
+} // namespace
+
+/* -------------------------------------------------------------------------
+   Format detection
+   --------------------------------------------------------------------- */
+Compression detect_compression(const std::string& path)
+{
+  unsigned char m[4] = {0, 0, 0, 0};
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) throw std::runtime_error("Cannot open " + path);
+  const std::size_t got = std::fread(m, 1, sizeof m, fh);
+  std::fclose(fh);
+
+  const Compression c = sniff(m, got);
+  return c == Compression::Gzip && is_bgzf(path) ? Compression::Bgzf : c;
+}
+
+const char* compression_name(Compression c)
+{
+  switch (c) {
+    case Compression::Gzip: return "gzip";
+    case Compression::Bgzf: return "BGZF";
+    case Compression::Zstd: return "zstd";
+    case Compression::Lz4:  return "lz4";
+    default:                return "uncompressed";
+  }
+}
+
+/* -------------------------------------------------------------------------
+   InputStream
+   --------------------------------------------------------------------- */
+std::size_t InputStream::read(char* buf, std::size_t n)
+{
+  std::size_t done = 0;
+  if (pendPos_ < pend_.size()) {
+    done = std::min(n, pend_.size() - pendPos_);
+    std::memcpy(buf, pend_.data() + pendPos_, done);
+    pendPos_ += done;
+  }
+  while (done < n) {
+    const std::size_t got = read_raw(buf + done, n - done);
+    if (got == 0) break;
+    done += got;
+  }
+  pos_ += done;
+  return done;
+}
+
+bool InputStream::getline(std::string& line)
+{
+  line.clear();
+  std::size_t scanned = pendPos_;   // no newline in [pendPos_, scanned)
+  while (true) {
+    const char* beg = pend_.data() + scanned;
+    const char* end = pend_.data() + pend_.size();
+    const char* nl  = static_cast<const char*>(std::memchr(beg, '\n', static_cast<std::size_t>(end - beg)));
+    if (nl) {
+      const std::size_t len = static_cast<std::size_t>(nl - (pend_.data() + pendPos_));
+      line.assign(pend_.data() + pendPos_, len);
+      pendPos_ += len + 1;
+      pos_     += len + 1;
+      return true;
+    }
+
+    // no newline buffered: drop what was consumed and read more
+    scanned = pend_.size() - pendPos_;
+    pend_.erase(pend_.begin(), pend_.begin() + static_cast<std::ptrdiff_t>(pendPos_));
+    pendPos_ = 0;
+    const std::size_t more = std::max(READ_AHEAD, scanned);   // long lines: grow geometrically
+    pend_.resize(scanned + more);
+    const std::size_t got = read_raw(pend_.data() + scanned, more);
+    pend_.resize(scanned + got);
+    if (got == 0) {
+      if (pend_.empty()) return false;
+      line.assign(pend_.data(), pend_.size());   // last line without a newline
+      pos_ += pend_.size();
+      pend_.clear();
+      return true;
+    }
+  }
+}
+
+bool is_stream(const std::string& path)
+{
+  struct stat st;
+  return path == "-" || (::stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode));
+}
+
+// Streams: read the magic bytes, then hand them to the decoder along with
+// the descriptor.  Nothing here needs to seek.
+static std::unique_ptr<InputStream> open_stream(const std::string& path)
+{
+  const int fd = path == "-" ? ::dup(STDIN_FILENO) : ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open " + path);
+
+  std::string prefix(4, '\0');
+  std::size_t got = 0;
+  try {
+    for (std::size_t k; got < 4 && (k = read_fd(fd, &prefix[got], 4 - got, path)) > 0; )
+      got += k;
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  prefix.resize(got);
+
+  switch (sniff(reinterpret_cast<const unsigned char*>(prefix.data()), got)) {
+    case Compression::Gzip:
+      return std::make_unique<InflateStream>(path, std::make_unique<FdSource>(path, fd, prefix));
+    case Compression::Zstd:
+#ifdef HAVE_ZSTD
+      return std::make_unique<ZstdStream>(path, fd, prefix);
+#else
+      ::close(fd);
+      throw std::runtime_error(path + " is zstd-compressed, but zstd support was not built in");
+#endif
+    case Compression::Lz4:
+#ifdef HAVE_LZ4
+      return std::make_unique<Lz4Stream>(path, fd, prefix);
+#else
+      ::close(fd);
+      throw std::runtime_error(path + " is lz4-compressed, but lz4 support was not built in");
+#endif
+    default:
+      return std::make_unique<PlainStream>(path, fd, prefix);
+  }
+}
+
+static std::atomic<ReadBackend> g_backend{ReadBackend::Sync};
+
+void set_read_backend(ReadBackend backend) { g_backend = backend; }
+
+std::unique_ptr<InputStream> open_input(const std::string& path)
+{
+  if (is_stream(path)) return open_stream(path);
+  const Compression c       = detect_compression(path);
+  const ReadBackend backend = g_backend;
+  switch (c) {
+    case Compression::Gzip:
+    case Compression::Bgzf:
+      if (backend != ReadBackend::Sync)
+        return std::make_unique<InflateStream>(path, open_read_ahead(path, backend));
+      return std::make_unique<GzipStream>(path);
+    case Compression::Zstd:
+#ifdef HAVE_ZSTD
+      return std::make_unique<ZstdStream>(path);
+#else
+      throw std::runtime_error(path + " is zstd-compressed, but zstd support was not built in");
+#endif
+    case Compression::Lz4:
+#ifdef HAVE_LZ4
+      return std::make_unique<Lz4Stream>(path);
+#else
+      throw std::runtime_error(path + " is lz4-compressed, but lz4 support was not built in");
+#endif
+    default:
+      if (backend != ReadBackend::Sync)
+        return std::make_unique<SourceStream>(path, open_read_ahead(path, backend));
+      return std::make_unique<PlainStream>(path);
+  }
+}
+
+/* -------------------------------------------------------------------------
+   Seekable zstd
+   --------------------------------------------------------------------- */
+std::vector<ZstdFrame> zstd_seek_table(const std::string& path)
+{
+  std::vector<ZstdFrame> frames;
+#ifdef HAVE_ZSTD
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) return frames;
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> guard(fh, std::fclose);
+
+  // footer: frame count (4), descriptor (1), seekable magic (4)
+  unsigned char foot[9];
+  if (fseeko(fh, 0, SEEK_END) != 0) return frames;
+  const off_t size = ftello(fh);
+  if (size < 17 || fseeko(fh, size - 9, SEEK_SET) != 0 ||
+      std::fread(foot, 1, 9, fh) != 9 || get_le32(foot + 5) != SEEKABLE_MAGIC)
+    return frames;
+  const std::uint32_t n     = get_le32(foot);
+  const std::size_t   entry = (foot[4] & 0x80) ? 12 : 8;   // with checksums
+  const std::uint64_t table = std::uint64_t{n} * entry;
+  if (static_cast<std::uint64_t>(size) < table + 17) return frames;
+
+  // skippable frame header right before the entries
+  std::vector<unsigned char> buf(8 + table);
+  if (fseeko(fh, size - 9 - static_cast<off_t>(table) - 8, SEEK_SET) != 0 ||
+      std::fread(buf.data(), 1, buf.size(), fh) != buf.size() ||
+      (get_le32(buf.data()) & SKIPPABLE_MASK) != SKIPPABLE_MAGIC ||
+      get_le32(buf.data() + 4) != table + 9)
+    return frames;
+
+  std::uint64_t c = 0, d = 0;
+  for (std::uint32_t k = 0; k < n; ++k) {
+    const unsigned char* e = buf.data() + 8 + k * entry;
+    ZstdFrame f;
+    f.cOffset = c; f.cSize = get_le32(e);
+    f.dOffset = d; f.dSize = get_le32(e + 4);
+    c += f.cSize; d += f.dSize;
+    frames.push_back(f);
+  }
+#else
+  (void)path;
+#endif
+  return frames;
+}
+
+std::unique_ptr<InputStream> open_zstd_at(const std::string& path, const ZstdFrame& from)
+{
+#ifdef HAVE_ZSTD
+  return std::make_unique<ZstdStream>(path, from.cOffset, from.dOffset);
+#else
+  (void)from;
+  throw std::runtime_error(path + " is zstd-compressed, but zstd support was not built in");
+#endif
+}
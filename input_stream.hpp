@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async_reader.hpp"
+
+/*
+------------------------------------------------------------------------------
+ Decompressing input streams behind one interface, so the parser does not
+ care how a painter output was stored.  The format is taken from the magic
+ bytes, never the file name:
+   gzip / BGZF   zlib (always available)
+   zstd          libzstd, if found at build time (HAVE_ZSTD); seekable-zstd
+                 files additionally expose their frame table for parallel
+                 decoding
+   lz4 frame     liblz4, if found at build time (HAVE_LZ4)
+   anything else read as uncompressed text, with plain read(2)
+ Pipes, FIFOs and stdin ("-") are streams: they are opened once, the format
+ is sniffed from the first bytes read, and decoding carries on from there.
+------------------------------------------------------------------------------
+*/
+
+enum class Compression { None, Gzip, Bgzf, Zstd, Lz4 };
+
+// Reads the first bytes of `path`; not for streams, which it would consume.
+Compression detect_compression(const std::string& path);
+const char* compression_name(Compression c);
+
+class InputStream {
+public:
+  virtual ~InputStream() = default;
+  InputStream(const InputStream&)            = delete;
+  InputStream& operator=(const InputStream&) = delete;
+
+  // read up to n decompressed bytes; returns 0 at end of input, throws on
+  // corrupt or truncated data
+  std::size_t read(char* buf, std::size_t n);
+
+  // read one line (newline stripped); false at end of input
+  bool getline(std::string& line);
+
+  // decompressed offset of the next byte handed out
+  std::uint64_t tell() const { return pos_; }
+
+  // compressed bytes consumed so far (progress / size estimates)
+  virtual std::uint64_t compressed_offset() const = 0;
+
+  const std::string& path() const { return path_; }
+
+protected:
+  InputStream(std::string path, std::uint64_t start = 0)
+    : path_(std::move(path)), pos_(start) {}
+
+  // bytes already read from the source that are to be handed out first
+  void preload(const std::string& bytes) { pend_.assign(bytes.begin(), bytes.end()); }
+
+  // the format-specific part: next decompressed bytes, 0 at the end
+  virtual std::size_t read_raw(char* buf, std::size_t n) = 0;
+
+  std::string path_;
+
+private:
+  std::vector<char> pend_;       // read ahead by getline(), not handed out yet
+  std::size_t       pendPos_ = 0;
+  std::uint64_t     pos_;
+};
+
+// "-" (stdin), or anything that is not a regular file: a pipe, a FIFO, a
+// process substitution.  Streams can be read only once and not seeked.
+bool is_stream(const std::string& path);
+
+// How open_input() reads gzip / BGZF and uncompressed regular files from
+// now on (process-wide; Sync by default).  zstd and lz4 keep their own
+// reads.
+void set_read_backend(ReadBackend backend);
+
+// Open `path` with the decoder its magic bytes call for; throws if it
+// cannot be opened or its format was not compiled in.
+std::unique_ptr<InputStream> open_input(const std::string& path);
+
+/* -------------------------------------------------------------------------
+   Seekable zstd: independent frames plus a seek table in a trailing
+   skippable frame (the zstd "seekable format")
+   --------------------------------------------------------------------- */
+struct ZstdFrame {
+  std::uint64_t cOffset = 0, cSize = 0;   // compressed position and size
+  std::uint64_t dOffset = 0, dSize = 0;   // decompressed position and size
+};
+
+// The frames of a seekable-zstd file; empty if `path` is not one (or zstd
+// support is not built in).
+std::vector<ZstdFrame> zstd_seek_table(const std::string& path);
+
+// Decode `path` starting at `from` (tell() starts at from.dOffset).
+std::unique_ptr<InputStream> open_zstd_at(const std::string& path, const ZstdFrame& from);
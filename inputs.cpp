@@ -0,0 +1,93 @@
+#include "inputs.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <glob.h>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+/* --------------------------------------------------------------------- */
+std::vector<InputFile> read_manifest(const std::string& manifest)
+{
+  std::ifstream in(manifest);
+  if (!in) throw std::runtime_error("Cannot open manifest " + manifest);
+
+  std::vector<InputFile> files;
+  std::size_t lineNo = 0;
+  for (std::string line; std::getline(in, line); ) {
+    ++lineNo;
+    std::istringstream ss(line);
+    InputFile f;
+    if (!(ss >> f.path) || f.path[0] == '#') continue;
+
+    std::string w, extra;
+    if (ss >> w) {
+      char* end = nullptr;
+      errno = 0;
+      f.weight = std::strtof(w.c_str(), &end);
+      if (errno || *end || (ss >> extra))
+        throw std::runtime_error(manifest + ":" + std::to_string(lineNo) +
+                                 ": expected \"<path> [weight]\"");
+    }
+    files.push_back(std::move(f));
+  }
+  if (files.empty()) throw std::runtime_error("Manifest " + manifest + " lists no files");
+  return files;
+}
+
+std::vector<InputFile> expand_glob(const std::string& pattern)
+{
+  glob_t g{};
+  const int rc = glob(pattern.c_str(), 0, nullptr, &g);
+  if (rc != 0) {
+    globfree(&g);
+    throw std::runtime_error(rc == GLOB_NOMATCH ? "No files match " + pattern
+                                                : "glob failed for " + pattern);
+  }
+  std::vector<InputFile> files;
+  files.reserve(g.gl_pathc);
+  for (std::size_t i = 0; i < g.gl_pathc; ++i) files.push_back({g.gl_pathv[i]});
+  globfree(&g);
+  return files;   // glob() already sorts the matches
+}
+
+std::vector<std::string> read_id_list(const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot open ID list " + path);
+  std::vector<std::string> ids;
+  for (std::string line; std::getline(in, line); ) {
+    std::istringstream ss(line);
+    std::string id;
+    if (ss >> id) ids.push_back(std::move(id));
+  }
+  if (ids.empty()) throw std::runtime_error("ID list " + path + " is empty");
+  return ids;
+}
+
+void stat_inputs(std::vector<InputFile>& files)
+{
+  for (auto& f : files) {
+    if (f.path == "-") { f.stream = true; continue; }
+    struct stat st;
+    if (::stat(f.path.c_str(), &st) != 0)
+      throw std::runtime_error("Cannot stat " + f.path + ": " + std::strerror(errno));
+    f.stream = !S_ISREG(st.st_mode);
+    f.bytes  = f.stream ? 0 : static_cast<std::uint64_t>(st.st_size);
+  }
+}
+
+std::vector<std::size_t> largest_first(const std::vector<InputFile>& files)
+{
+  std::vector<std::size_t> order(files.size());
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    return files[a].bytes > files[b].bytes;
+  });
+  return order;
+}
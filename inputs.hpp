@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+------------------------------------------------------------------------------
+ Input file lists: chromosome templates, manifests and glob patterns all end
+ up as a list of InputFile which is stat'ed once up front.
+------------------------------------------------------------------------------
+*/
+
+struct InputFile {
+  std::string   path;
+  float         weight = 1.0f;   // every value of the file is scaled by this
+  std::uint64_t bytes  = 0;      // on-disk size, filled by stat_inputs()
+  bool          stream = false;  // stdin ("-") or a pipe / FIFO: read once
+};
+
+// One input per line: "<path> [weight]".  Blank lines and lines starting
+// with '#' are skipped; paths are taken as written (relative to the cwd).
+std::vector<InputFile> read_manifest(const std::string& manifest);
+
+// Shell-style pattern, matches in sorted order; throws if nothing matches.
+std::vector<InputFile> expand_glob(const std::string& pattern);
+
+// One ID per line (blank lines skipped), e.g. a master sample order.
+std::vector<std::string> read_id_list(const std::string& path);
+
+// Fill in `bytes` and `stream` for every input (streams have 0 bytes);
+// throws on the first missing file.
+void stat_inputs(std::vector<InputFile>& files);
+
+// Indices into `files`, largest first: hand these out to workers so the
+// big chromosomes start early and the small ones fill in the tail.
+std::vector<std::size_t> largest_first(const std::vector<InputFile>& files);
@@ -0,0 +1,949 @@
+#include "matrix_io.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/types.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <zlib.h>
+
+#include "bgzf.hpp"
+#include "input_stream.hpp"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* --------------------------------------------------------------------- */
+bool parse_out_format(const std::string& s, OutFormat& fmt)
+{
+  if (s == "text") { fmt = OutFormat::Text; return true; }
+  if (s == "npy")  { fmt = OutFormat::Npy;  return true; }
+  if (s == "raw")  { fmt = OutFormat::Raw;  return true; }
+  return false;
+}
+
+static const char* format_name(OutFormat fmt)
+{
+  switch (fmt) {
+    case OutFormat::Text: return "text";
+    case OutFormat::Npy:  return "npy";
+    case OutFormat::Raw:  return "raw";
+  }
+  return "";
+}
+
+/* -------------------------------------------------------------------------
+   Output sinks: plain file, gzip stream, BGZF blocks, zstd stream
+   --------------------------------------------------------------------- */
+namespace {
+
+class OutSink {
+public:
+  virtual ~OutSink() = default;
+  virtual void write(const void* data, std::size_t n) = 0;
+  virtual std::uint64_t tell() const = 0;   // offset usable for the row index
+  // end the current gzip member / BGZF block / zstd frame here; returns the
+  // file offset the next one starts at (row bands, see merge_bands())
+  virtual std::uint64_t boundary() = 0;
+  virtual void close() = 0;
+};
+
+class FileSink : public OutSink {
+public:
+  explicit FileSink(const std::string& path) : path_(path)
+  {
+    fh_ = std::fopen(path.c_str(), "wb");
+    if (!fh_) throw std::runtime_error("Cannot create output " + path);
+  }
+  ~FileSink() override { if (fh_) std::fclose(fh_); }
+  void write(const void* data, std::size_t n) override
+  {
+    if (n && std::fwrite(data, 1, n, fh_) != n)
+      throw std::runtime_error("Write error on " + path_);
+    pos_ += n;
+  }
+  std::uint64_t tell() const override { return pos_; }
+  std::uint64_t boundary() override { return pos_; }
+  void close() override
+  {
+    const bool ok = std::fclose(fh_) == 0;
+    fh_ = nullptr;
+    if (!ok) throw std::runtime_error("Write error on " + path_);
+  }
+private:
+  std::string   path_;
+  std::FILE*    fh_ = nullptr;
+  std::uint64_t pos_ = 0;
+};
+
+class GzSink : public OutSink {
+public:
+  explicit GzSink(const std::string& path) : path_(path)
+  {
+    gz_ = gzopen(path.c_str(), "wb");
+    if (!gz_) throw std::runtime_error("Cannot create output " + path);
+  }
+  ~GzSink() override { if (gz_) gzclose(gz_); }
+  void write(const void* data, std::size_t n) override
+  {
+    if (n && gzwrite(gz_, data, static_cast<unsigned>(n)) != static_cast<int>(n))
+      throw std::runtime_error("Write error on " + path_);
+    pos_ += n;
+  }
+  std::uint64_t tell() const override { return pos_; }
+  // Z_FINISH completes the member; the next write starts a new one
+  std::uint64_t boundary() override
+  {
+    if (gzflush(gz_, Z_FINISH) != Z_OK) throw std::runtime_error("Write error on " + path_);
+    return static_cast<std::uint64_t>(gzoffset(gz_));
+  }
+  void close() override
+  {
+    const bool ok = gzclose(gz_) == Z_OK;
+    gz_ = nullptr;
+    if (!ok) throw std::runtime_error("Write error on " + path_);
+  }
+private:
+  std::string   path_;
+  gzFile        gz_ = nullptr;
+  std::uint64_t pos_ = 0;
+};
+
+class BgzfSink : public OutSink {
+public:
+  explicit BgzfSink(const std::string& path) : w_(path) {}
+  void write(const void* data, std::size_t n) override { w_.write(data, n); }
+  std::uint64_t tell() const override { return w_.tell(); }
+  std::uint64_t boundary() override { return w_.end_block(); }
+  void close() override { w_.close(); }
+private:
+  BgzfWriter w_;
+};
+
+#ifdef HAVE_ZSTD
+// libzstd compresses on `threads` workers of its own (ZSTD_c_nbWorkers)
+// while the caller keeps formatting rows
+class ZstdSink : public OutSink {
+public:
+  ZstdSink(const std::string& path, int level, unsigned threads)
+    : path_(path), out_(ZSTD_CStreamOutSize())
+  {
+    fh_ = std::fopen(path.c_str(), "wb");
+    if (!fh_) throw std::runtime_error("Cannot create output " + path);
+    cctx_ = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+    if (threads > 1)   // an error here just means a single-threaded libzstd
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_nbWorkers, static_cast<int>(threads));
+  }
+  ~ZstdSink() override
+  {
+    ZSTD_freeCCtx(cctx_);
+    if (fh_) std::fclose(fh_);
+  }
+  void write(const void* data, std::size_t n) override
+  {
+    ZSTD_inBuffer in{data, n, 0};
+    while (in.pos < in.size) pump(in, ZSTD_e_continue);
+    pos_ += n;
+  }
+  std::uint64_t tell() const override { return pos_; }
+  std::uint64_t boundary() override
+  {
+    ZSTD_inBuffer in{nullptr, 0, 0};
+    while (pump(in, ZSTD_e_end) != 0) {}
+    return written_;
+  }
+  void close() override
+  {
+    ZSTD_inBuffer in{nullptr, 0, 0};
+    while (pump(in, ZSTD_e_end) != 0) {}
+    const bool ok = std::fclose(fh_) == 0;
+    fh_ = nullptr;
+    if (!ok) throw std::runtime_error("Write error on " + path_);
+  }
+private:
+  // one compression step; returns what ZSTD_compressStream2 has left to flush
+  std::size_t pump(ZSTD_inBuffer& in, ZSTD_EndDirective mode)
+  {
+    ZSTD_outBuffer o{out_.data(), out_.size(), 0};
+    const std::size_t left = ZSTD_compressStream2(cctx_, &o, &in, mode);
+    if (ZSTD_isError(left))
+      throw std::runtime_error("zstd error on " + path_ + ": " + ZSTD_getErrorName(left));
+    if (o.pos && std::fwrite(out_.data(), 1, o.pos, fh_) != o.pos)
+      throw std::runtime_error("Write error on " + path_);
+    written_ += o.pos;
+    return left;
+  }
+
+  std::string       path_;
+  std::FILE*        fh_   = nullptr;
+  ZSTD_CCtx*        cctx_ = nullptr;
+  std::vector<char> out_;
+  std::uint64_t     pos_  = 0;
+  std::uint64_t     written_ = 0;   // compressed bytes
+};
+#endif
+
+} // namespace
+
+/* -------------------------------------------------------------------------
+   Small helpers
+   --------------------------------------------------------------------- */
+static bool host_little_endian()
+{
+  const std::uint16_t one = 1;
+  unsigned char b;
+  std::memcpy(&b, &one, 1);
+  return b == 1;
+}
+
+// "<name> v v v ...\n" with "%.6f" per value, appended to `out`
+static void format_row(std::string& out, std::string_view name,
+                       const float* v, std::size_t ncols)
+{
+  char num[64];
+  out += name;
+  for (std::size_t c = 0; c < ncols; ++c) {
+    const int k = std::snprintf(num, sizeof num, " %.6f", v[c]);
+    out.append(num, static_cast<std::size_t>(k));
+  }
+  out += '\n';
+}
+
+static void write_small_file(const std::string& path, const std::string& data)
+{
+  FileSink f(path);
+  f.write(data.data(), data.size());
+  f.close();
+}
+
+static void write_names(const std::string& path, const NameTable& names)
+{
+  std::string buf;
+  buf.reserve(names.bytes());
+  for (std::size_t i = 0; i < names.size(); ++i) { buf += names[i]; buf += '\n'; }
+  write_small_file(path, buf);
+}
+
+static std::vector<std::string> read_names(const std::string& path)
+{
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot open " + path);
+  std::vector<std::string> names;
+  for (std::string s; std::getline(in, s); ) names.push_back(s);
+  return names;
+}
+
+// names only ever hold non-whitespace tokens; escape the JSON specials anyway
+static std::string json_str(const std::string& s)
+{
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + '"';
+}
+
+// value of "key" in the flat JSON written by write_descriptor(), quotes
+// stripped; empty if absent
+static std::string json_field(const std::string& json, const std::string& key)
+{
+  const auto k = json.find('"' + key + '"');
+  if (k == std::string::npos) return "";
+  auto p = json.find(':', k);
+  if (p == std::string::npos) return "";
+  ++p;
+  while (p < json.size() && json[p] == ' ') ++p;
+  if (p < json.size() && json[p] == '"') {
+    std::string out;
+    for (++p; p < json.size() && json[p] != '"'; ++p) {
+      if (json[p] == '\\' && p + 1 < json.size()) ++p;
+      out += json[p];
+    }
+    return out;
+  }
+  const auto e = json.find_first_of(",}\n", p);
+  return json.substr(p, e - p);
+}
+
+static std::string base_name(const std::string& path)
+{
+  const auto slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool file_exists(const std::string& path)
+{
+  std::ifstream f(path);
+  return static_cast<bool>(f);
+}
+
+// the input type whose ID column label heads the output
+static bool type_of_label(const std::string& label, InputType& type)
+{
+  for (InputType t : {InputType::Pbwt, InputType::ChromoPainter, InputType::SparsePainter})
+    if (label == id_label(t)) { type = t; return true; }
+  return false;
+}
+
+static std::string read_file(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Cannot open " + path);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+/* -------------------------------------------------------------------------
+   Writers
+   --------------------------------------------------------------------- */
+// NumPy format version 1.0: magic, 2-byte header length, python dict
+// literal padded with spaces so the data starts on a 64-byte boundary
+static std::string npy_header(const CombinedMatrix& m)
+{
+  std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': (" +
+                     std::to_string(m.nrows) + ", " + std::to_string(m.ncols) +
+                     "), }";
+  const std::size_t preamble = 10;
+  std::size_t hlen = dict.size() + 1;
+  hlen += (64 - (preamble + hlen) % 64) % 64;
+  dict.append(hlen - dict.size() - 1, ' ');
+  dict += '\n';
+
+  std::string head = "\x93NUMPY";
+  head += '\x01'; head += '\x00';
+  head += static_cast<char>(hlen & 0xff);
+  head += static_cast<char>((hlen >> 8) & 0xff);
+  return head + dict;
+}
+
+static void write_descriptor(const std::string& path, const CombinedMatrix& m,
+                             const WriteOptions& opts, std::size_t offset)
+{
+  const std::string base = base_name(path);
+  const std::string json =
+      "{\n"
+      "  \"format\": " + json_str(format_name(opts.format)) + ",\n"
+      "  \"compression\": " + json_str(opts.bgzf ? "bgzf" : opts.zstd ? "zstd" : "none") + ",\n"
+      "  \"dtype\": \"float32\",\n"
+      "  \"byte_order\": \"little\",\n"
+      "  \"order\": \"C\",\n"
+      "  \"shape\": [" + std::to_string(m.nrows) + ", " + std::to_string(m.ncols) + "],\n"
+      "  \"offset\": " + std::to_string(offset) + ",\n"
+      "  \"id_label\": " + json_str(id_label(m.type)) + ",\n"
+      "  \"data\": " + json_str(base) + ",\n"
+      "  \"rows\": " + json_str(base + ".rows") + ",\n"
+      "  \"cols\": " + json_str(base + ".cols") + "\n"
+      "}\n";
+  write_small_file(path + ".json", json);
+}
+
+static void write_row_index(const std::string& path, const CombinedMatrix& m,
+                            const std::vector<std::uint64_t>& index)
+{
+  std::string buf = "#ridx\t" + std::to_string(m.ncols) + '\n';
+  for (std::size_t r = 0; r < m.nrows; ++r) {
+    buf += m.rowNames[r];
+    buf += '\t';
+    buf += std::to_string(index[r]);
+    buf += '\n';
+  }
+  write_small_file(path + ".ridx", buf);
+}
+
+// <out>.band: where this band sits in the full result and which bytes of
+// <out> hold its rows
+//   #band <tab> firstRow <tab> nrows <tab> fullRows <tab> dataBegin <tab> dataEnd
+struct BandInfo {
+  std::string   path;
+  std::size_t   firstRow = 0, nrows = 0, fullRows = 0;
+  std::uint64_t begin = 0, end = 0;   // file offsets of the rows
+};
+
+static void write_band_info(const std::string& path, const CombinedMatrix& m,
+                            std::uint64_t begin, std::uint64_t end)
+{
+  write_small_file(path + ".band",
+                   "#band\t" + std::to_string(m.firstRow) + '\t' + std::to_string(m.nrows) +
+                   '\t' + std::to_string(m.fullRows) + '\t' + std::to_string(begin) +
+                   '\t' + std::to_string(end) + '\n');
+}
+
+static BandInfo read_band_info(const std::string& path)
+{
+  std::ifstream in(path + ".band");
+  std::string tag;
+  BandInfo b;
+  if (!(in >> tag >> b.firstRow >> b.nrows >> b.fullRows >> b.begin >> b.end) ||
+      tag != "#band" || b.begin > b.end)
+    throw std::runtime_error(path + " is not a row band output (no valid " + path + ".band)");
+  b.path = path;
+  return b;
+}
+
+struct MatrixWriter::Impl {
+  std::string                path;
+  WriteOptions               opts;
+  std::unique_ptr<OutSink>   out;
+  const CombinedMatrix*      m = nullptr;
+  std::size_t                next   = 0;   // rows written so far
+  std::size_t                offset = 0;   // npy header bytes
+  std::uint64_t              dataBegin = 0;   // row band: file offset of its rows
+  std::vector<std::uint64_t> index;        // with bgzf: offset of every row
+  std::string                line;
+  std::vector<std::uint32_t> swapped;      // big-endian hosts
+};
+
+MatrixWriter::MatrixWriter(std::string path, WriteOptions opts)
+  : impl_(std::make_unique<Impl>())
+{
+  impl_->path = std::move(path);
+  impl_->opts = opts;
+}
+
+MatrixWriter::~MatrixWriter() = default;
+
+void MatrixWriter::begin(const CombinedMatrix& m)
+{
+  Impl& w = *impl_;
+  const WriteOptions& opts = w.opts;
+  if (opts.bgzf && opts.zstd)
+    throw std::runtime_error("BGZF and zstd output can't be combined (" + w.path + ")");
+  if (opts.bgzf)                           w.out = std::make_unique<BgzfSink>(w.path);
+  else if (opts.zstd) {
+#ifdef HAVE_ZSTD
+    w.out = std::make_unique<ZstdSink>(w.path, opts.zstdLevel, opts.threads);
+#else
+    throw std::runtime_error("zstd output (" + w.path + ") needs a build with libzstd");
+#endif
+  }
+  else if (opts.format == OutFormat::Text) w.out = std::make_unique<GzSink>(w.path);
+  else                                     w.out = std::make_unique<FileSink>(w.path);
+
+  w.m    = &m;
+  w.next = 0;
+  if (opts.bgzf) w.index.reserve(m.nrows);
+
+  if (opts.format == OutFormat::Text) {
+    std::string& line = w.line;
+    line.clear();
+    line += id_label(m.type);
+    for (std::size_t c = 0; c < m.ncols; ++c) { line += ' '; line += m.colNames[c]; }
+    line += '\n';
+    w.out->write(line.data(), line.size());
+  } else if (opts.format == OutFormat::Npy) {
+    const std::string head = npy_header(m);
+    w.out->write(head.data(), head.size());
+    w.offset = head.size();
+  }
+  // a band's rows get members / blocks / frames of their own, so
+  // merge_bands() can copy them without decompressing
+  if (m.fullRows) w.dataBegin = w.out->boundary();
+}
+
+// binary rows go out in one write on little-endian hosts when no index is
+// wanted, row by row otherwise (byte-swapped on big-endian hosts)
+void MatrixWriter::write_rows(const float* values, std::size_t n)
+{
+  Impl& w = *impl_;
+  const CombinedMatrix& m = *w.m;
+  if (w.next + n > m.nrows)
+    throw std::runtime_error("More rows than the " + std::to_string(m.nrows) +
+                             " expected for " + w.path);
+  const bool index = w.opts.bgzf;
+
+  if (w.opts.format == OutFormat::Text) {
+    for (std::size_t k = 0; k < n; ++k, ++w.next) {
+      if (index) w.index.push_back(w.out->tell());
+      w.line.clear();
+      format_row(w.line, m.rowNames[w.next], values + k * m.ncols, m.ncols);
+      w.out->write(w.line.data(), w.line.size());
+    }
+    return;
+  }
+
+  const std::size_t rowBytes = m.ncols * sizeof(float);
+  const bool le = host_little_endian();
+  if (le && !index) {
+    w.out->write(values, n * rowBytes);
+    w.next += n;
+    return;
+  }
+  w.swapped.resize(le ? 0 : m.ncols);
+  for (std::size_t k = 0; k < n; ++k, ++w.next) {
+    if (index) w.index.push_back(w.out->tell());
+    const float* row = values + k * m.ncols;
+    if (le) { w.out->write(row, rowBytes); continue; }
+    std::memcpy(w.swapped.data(), row, rowBytes);
+    for (auto& x : w.swapped) x = __builtin_bswap32(x);
+    w.out->write(w.swapped.data(), rowBytes);
+  }
+}
+
+void MatrixWriter::end()
+{
+  Impl& w = *impl_;
+  const CombinedMatrix& m = *w.m;
+  if (w.next != m.nrows)
+    throw std::runtime_error("Only " + std::to_string(w.next) + " of " +
+                             std::to_string(m.nrows) + " rows written to " + w.path);
+  if (w.opts.format != OutFormat::Text) {
+    write_names(w.path + ".rows", m.rowNames);
+    write_names(w.path + ".cols", m.colNames);
+    write_descriptor(w.path, m, w.opts, w.offset);
+  }
+  const std::uint64_t dataEnd = m.fullRows ? w.out->boundary() : 0;
+  w.out->close();
+
+  if (w.opts.bgzf) write_row_index(w.path, m, w.index);
+  else             std::remove((w.path + ".ridx").c_str());   // never leave a stale index
+  if (m.fullRows)  write_band_info(w.path, m, w.dataBegin, dataEnd);
+  else             std::remove((w.path + ".band").c_str());
+}
+
+void write_matrix(const std::string& path, const CombinedMatrix& m,
+                  const WriteOptions& opts)
+{
+  MatrixWriter w(path, opts);
+  w.begin(m);
+  w.write_rows(m.total.data(), m.nrows);
+  w.end();
+}
+
+/* -------------------------------------------------------------------------
+   Reading outputs back
+   --------------------------------------------------------------------- */
+struct MatrixReader::Impl {
+  std::string                  path;
+  InputType                    type = InputType::Pbwt;
+  NameTable                    cols, rows;   // rows: binary only
+  bool                         binary = false;
+  std::size_t                  next   = 0;   // rows handed out so far
+  int                          fd     = -1;  // uncompressed binary
+  std::unique_ptr<InputStream> in;           // text, or compressed binary
+  std::string                  line;
+
+  ~Impl() { if (fd >= 0) ::close(fd); }
+
+  // exactly n bytes of binary data, or fewer only at the end
+  std::size_t read_data(char* buf, std::size_t n)
+  {
+    std::size_t got = 0;
+    while (got < n) {
+      std::size_t k;
+      if (fd < 0) {
+        k = in->read(buf + got, n - got);
+      } else {
+        const ssize_t r = ::read(fd, buf + got, n - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) throw std::runtime_error("Read error on " + path);
+        k = static_cast<std::size_t>(r);
+      }
+      if (k == 0) break;
+      got += k;
+    }
+    return got;
+  }
+};
+
+MatrixReader::MatrixReader(const std::string& path) : impl_(std::make_unique<Impl>())
+{
+  Impl& r = *impl_;
+  r.path   = path;
+  r.binary = file_exists(path + ".json");
+
+  if (!r.binary) {
+    r.in = open_input(path);
+    if (!r.in->getline(r.line)) throw std::runtime_error("Empty file " + path);
+    std::istringstream head(r.line);
+    std::string tok;
+    head >> tok;
+    if (!type_of_label(tok, r.type))
+      throw std::runtime_error(path + " is not a combined output (header starts with \"" +
+                               tok + "\")");
+    while (head >> tok) r.cols.add(tok);
+    return;
+  }
+
+  const std::string json = read_file(path + ".json");
+  const std::string dir  = path.substr(0, path.size() - base_name(path).size());
+  if (!type_of_label(json_field(json, "id_label"), r.type))
+    throw std::runtime_error("Bad descriptor " + path + ".json");
+  r.cols = NameTable::from(read_names(dir + json_field(json, "cols")));
+  r.rows = NameTable::from(read_names(dir + json_field(json, "rows")));
+
+  const std::string comp = json_field(json, "compression");
+  std::uint64_t skip = std::stoull(json_field(json, "offset"));   // npy header
+  if (comp == "none") {
+    r.fd = ::open(path.c_str(), O_RDONLY);
+    if (r.fd < 0) throw std::runtime_error("Cannot open " + path);
+    if (::lseek(r.fd, static_cast<off_t>(skip), SEEK_SET) < 0)
+      throw std::runtime_error("Cannot seek in " + path);
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(r.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  } else {
+    r.in = open_input(path);
+    for (char buf[256]; skip > 0; ) {
+      const std::size_t k = r.in->read(buf, std::min<std::uint64_t>(skip, sizeof buf));
+      if (k == 0) throw std::runtime_error("Truncated header in " + path);
+      skip -= k;
+    }
+  }
+}
+
+MatrixReader::~MatrixReader() = default;
+
+const std::string& MatrixReader::path()  const { return impl_->path; }
+InputType          MatrixReader::type()  const { return impl_->type; }
+const NameTable&   MatrixReader::cols()  const { return impl_->cols; }
+std::size_t        MatrixReader::nrows() const { return impl_->binary ? impl_->rows.size() : 0; }
+
+std::size_t MatrixReader::read_rows(float* vals, std::size_t n, NameTable& names)
+{
+  Impl& r = *impl_;
+  const std::size_t ncols = r.cols.size();
+
+  if (r.binary) {
+    n = std::min(n, r.rows.size() - r.next);
+    const std::size_t want = n * ncols * sizeof(float);
+    if (r.read_data(reinterpret_cast<char*>(vals), want) != want)
+      throw std::runtime_error("Truncated data in " + r.path);
+    if (!host_little_endian()) {
+      for (std::size_t i = 0; i < n * ncols; ++i) {
+        std::uint32_t w; std::memcpy(&w, vals + i, 4);
+        w = __builtin_bswap32(w); std::memcpy(vals + i, &w, 4);
+      }
+    }
+    for (std::size_t k = 0; k < n; ++k) names.add(r.rows[r.next + k]);
+    r.next += n;
+    return n;
+  }
+
+  std::size_t k = 0;
+  while (k < n && r.in->getline(r.line)) {
+    const char* p   = r.line.c_str();
+    const char* end = p + r.line.size();
+    while (p < end && std::isspace(static_cast<unsigned char>(*p))) ++p;
+    const char* name = p;
+    while (p < end && !std::isspace(static_cast<unsigned char>(*p))) ++p;
+    const std::string_view id(name, static_cast<std::size_t>(p - name));
+    if (id.empty()) continue;   // blank line
+    names.add(id);
+    float* row = vals + k * ncols;
+    for (std::size_t c = 0; c < ncols; ++c) {
+      char* e;
+      row[c] = std::strtof(p, &e);
+      if (e == p)
+        throw std::runtime_error("Row " + std::string(id) + " of " + r.path + " has " +
+                                 std::to_string(c) + " values, expected " +
+                                 std::to_string(ncols));
+      p = e;
+    }
+    ++k;
+  }
+  r.next += k;
+  return k;
+}
+
+/* -------------------------------------------------------------------------
+   Joining row bands
+   --------------------------------------------------------------------- */
+// put(data, n) over bytes [begin, end) of `path`, a MiB at a time
+template <class Put>
+static void copy_range(const std::string& path, std::uint64_t begin, std::uint64_t end, Put&& put)
+{
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) throw std::runtime_error("Cannot open " + path);
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> guard(fh, std::fclose);
+  if (fseeko(fh, static_cast<off_t>(begin), SEEK_SET) != 0)
+    throw std::runtime_error("Cannot seek in " + path);
+  std::vector<char> buf(1 << 20);
+  for (std::uint64_t left = end - begin; left; ) {
+    const std::size_t k = std::fread(buf.data(), 1, std::min<std::uint64_t>(left, buf.size()), fh);
+    if (k == 0) throw std::runtime_error("Truncated band " + path);
+    put(buf.data(), k);
+    left -= k;
+  }
+}
+
+static std::string compression_of(const std::string& path)
+{
+  switch (detect_compression(path)) {
+    case Compression::Gzip: return "gzip";
+    case Compression::Bgzf: return "bgzf";
+    case Compression::Zstd: return "zstd";
+    default: throw std::runtime_error(path + " is not a gzip, BGZF or zstd text output");
+  }
+}
+
+static std::string first_line(const std::string& path)
+{
+  std::string line;
+  if (!open_input(path)->getline(line)) throw std::runtime_error("Empty file " + path);
+  return line;
+}
+
+void merge_bands(const std::vector<std::string>& paths, const std::string& out)
+{
+  if (paths.empty()) throw std::runtime_error("No bands to merge");
+  std::vector<BandInfo> bands;
+  for (const auto& p : paths) bands.push_back(read_band_info(p));
+  std::sort(bands.begin(), bands.end(),
+            [](const BandInfo& a, const BandInfo& b) { return a.firstRow < b.firstRow; });
+
+  /* ---- the bands must tile rows [0, fullRows) exactly ------------------ */
+  const BandInfo&   head     = bands[0];
+  const std::size_t fullRows = head.fullRows;
+  std::size_t next = 0;
+  for (const auto& b : bands) {
+    if (b.fullRows != fullRows)
+      throw std::runtime_error(b.path + " is a band of a " + std::to_string(b.fullRows) +
+                               "-row result, " + head.path + " of a " +
+                               std::to_string(fullRows) + "-row one");
+    if (b.firstRow < next) throw std::runtime_error(b.path + " overlaps the band before it");
+    if (b.firstRow > next)
+      throw std::runtime_error("Rows [" + std::to_string(next) + ", " +
+                               std::to_string(b.firstRow) + ") are in none of the bands");
+    next = b.firstRow + b.nrows;
+  }
+  if (next != fullRows)
+    throw std::runtime_error("Rows [" + std::to_string(next) + ", " +
+                             std::to_string(fullRows) + ") are in none of the bands");
+
+  /* ---- ... and be written the same way, with the same columns ---------- */
+  const bool binary = file_exists(head.path + ".json");
+  std::string json, comp, cols, header;
+  if (binary) {
+    json   = read_file(head.path + ".json");
+    comp   = json_field(json, "compression");
+    cols   = read_file(head.path + ".cols");
+  } else {
+    comp   = compression_of(head.path);
+    header = first_line(head.path);
+  }
+  for (const auto& b : bands) {
+    bool same = file_exists(b.path + ".json") == binary;
+    if (same && binary) {
+      const std::string j = read_file(b.path + ".json");
+      same = json_field(j, "format") == json_field(json, "format") &&
+             json_field(j, "compression") == comp &&
+             json_field(j, "id_label") == json_field(json, "id_label");
+    } else if (same) {
+      same = compression_of(b.path) == comp;
+    }
+    if (!same) throw std::runtime_error(b.path + " is not written like " + head.path);
+    if (binary ? read_file(b.path + ".cols") != cols : first_line(b.path) != header)
+      throw std::runtime_error(b.path + " has different columns from " + head.path);
+  }
+
+  WriteOptions wo;
+  if (binary && !parse_out_format(json_field(json, "format"), wo.format))
+    throw std::runtime_error("Bad descriptor " + head.path + ".json");
+  wo.bgzf = comp == "bgzf";
+  wo.zstd = comp == "zstd";
+
+  // the shape of the whole result, for the npy header and descriptor
+  CombinedMatrix shape;
+  shape.nrows = fullRows;
+  if (binary) {
+    shape.ncols = static_cast<std::size_t>(std::count(cols.begin(), cols.end(), '\n'));
+    type_of_label(json_field(json, "id_label"), shape.type);
+  }
+  const std::string npyHead = binary && wo.format == OutFormat::Npy ? npy_header(shape) : "";
+
+  /* ---- header, then every band's rows as stored ------------------------ */
+  std::vector<std::uint64_t> starts;   // where each band's rows land in `out`
+  if (wo.bgzf) {
+    BgzfWriter w(out);
+    auto raw = [&](const char* p, std::size_t n) { w.write_raw(p, n); };
+    if (binary) w.write(npyHead.data(), npyHead.size());
+    else        copy_range(head.path, 0, head.begin, raw);
+    for (const auto& b : bands) {
+      starts.push_back(w.end_block());
+      copy_range(b.path, b.begin, b.end, raw);
+    }
+    w.close();
+  } else {
+    FileSink f(out);
+    auto raw = [&](const char* p, std::size_t n) { f.write(p, n); };
+    if (!binary) {
+      copy_range(head.path, 0, head.begin, raw);   // text: the same header in every band
+    } else if (!npyHead.empty() && wo.zstd) {
+#ifdef HAVE_ZSTD
+      std::vector<char> frame(ZSTD_compressBound(npyHead.size()));
+      const std::size_t k = ZSTD_compress(frame.data(), frame.size(), npyHead.data(),
+                                          npyHead.size(), wo.zstdLevel);
+      if (ZSTD_isError(k)) throw std::runtime_error("zstd error on " + out);
+      f.write(frame.data(), k);
+#else
+      throw std::runtime_error("Merging zstd bands needs a build with libzstd");
+#endif
+    } else {
+      f.write(npyHead.data(), npyHead.size());
+    }
+    for (const auto& b : bands) copy_range(b.path, b.begin, b.end, raw);
+    f.close();
+  }
+
+  /* ---- side files ------------------------------------------------------ */
+  if (binary) {
+    std::string rows;
+    for (const auto& b : bands) rows += read_file(b.path + ".rows");
+    write_small_file(out + ".rows", rows);
+    write_small_file(out + ".cols", cols);
+    write_descriptor(out, shape, wo, npyHead.size());
+  }
+  if (wo.bgzf) {
+    // shift every row's virtual offset by where its band's blocks moved to
+    std::string ridx;
+    for (std::size_t i = 0; i < bands.size(); ++i) {
+      std::ifstream in(bands[i].path + ".ridx");
+      std::string line;
+      if (!std::getline(in, line) || line.rfind("#ridx\t", 0) != 0)
+        throw std::runtime_error("No row index " + bands[i].path + ".ridx");
+      if (i == 0) ridx = line + '\n';
+      while (std::getline(in, line)) {
+        const auto tab = line.rfind('\t');
+        if (tab == std::string::npos) continue;
+        const std::uint64_t v = std::stoull(line.substr(tab + 1));
+        const std::uint64_t c = (v >> 16) - bands[i].begin + starts[i];
+        ridx.append(line, 0, tab + 1);
+        ridx += std::to_string((c << 16) | (v & 0xffff));
+        ridx += '\n';
+      }
+    }
+    write_small_file(out + ".ridx", ridx);
+  } else {
+    std::remove((out + ".ridx").c_str());
+  }
+  std::remove((out + ".band").c_str());
+}
+
+/* -------------------------------------------------------------------------
+   Row queries
+   --------------------------------------------------------------------- */
+// virtual offsets of the wanted rows from <path>.ridx
+static std::unordered_map<std::string, std::uint64_t>
+load_row_index(const std::string& path,
+               const std::unordered_map<std::string, std::uint64_t>& wanted)
+{
+  std::ifstream in(path + ".ridx");
+  if (!in) throw std::runtime_error("No row index " + path + ".ridx");
+  std::string line;
+  if (!std::getline(in, line) || line.rfind("#ridx\t", 0) != 0)
+    throw std::runtime_error("Bad row index " + path + ".ridx");
+
+  std::unordered_map<std::string, std::uint64_t> found;
+  while (std::getline(in, line)) {
+    const auto tab = line.find('\t');
+    if (tab == std::string::npos) continue;
+    const std::string name = line.substr(0, tab);
+    if (wanted.count(name))
+      found[name] = std::stoull(line.substr(tab + 1));
+  }
+  return found;
+}
+
+void query_rows(const std::string& path, const std::vector<std::string>& names,
+                std::ostream& out)
+{
+  std::unordered_map<std::string, std::uint64_t> wanted;
+  for (const auto& n : names) wanted.emplace(n, 0);
+
+  const bool binary = file_exists(path + ".json");
+
+  if (!binary) {
+    // text: BGZF + row index required
+    if (!is_bgzf(path) || !file_exists(path + ".ridx"))
+      throw std::runtime_error(path + " has no row index (write it with --bgzf)");
+    const auto found = load_row_index(path, wanted);
+    BgzfReader rd(path);
+    std::string line;
+    if (!rd.getline(line)) throw std::runtime_error("Empty file " + path);
+    out << line << '\n';
+    for (const auto& n : names) {
+      auto it = found.find(n);
+      if (it == found.end()) throw std::runtime_error("Row " + n + " not in " + path);
+      rd.seek(it->second);
+      rd.getline(line);
+      out << line << '\n';
+    }
+    return;
+  }
+
+  std::ifstream jin(path + ".json");
+  const std::string json((std::istreambuf_iterator<char>(jin)),
+                         std::istreambuf_iterator<char>());
+  const std::string dir = path.substr(0, path.size() - base_name(path).size());
+  const auto cols = read_names(dir + json_field(json, "cols"));
+  const std::size_t ncols  = cols.size();
+  const std::size_t offset = std::stoull(json_field(json, "offset"));
+  const std::string comp   = json_field(json, "compression");
+  const bool        bgzf   = comp == "bgzf";
+  if (comp != "bgzf" && comp != "none")
+    throw std::runtime_error(path + " is " + comp + "-compressed and can't be queried");
+
+  std::string line = json_field(json, "id_label");
+  for (const auto& c : cols) { line += ' '; line += c; }
+  out << line << '\n';
+
+  std::vector<float> row(ncols);
+  auto emit = [&](const std::string& name) {
+    if (!host_little_endian()) {
+      for (auto& v : row) {
+        std::uint32_t w; std::memcpy(&w, &v, 4);
+        w = __builtin_bswap32(w); std::memcpy(&v, &w, 4);
+      }
+    }
+    line.clear();
+    format_row(line, name, row.data(), ncols);
+    out << line;
+  };
+
+  if (bgzf) {
+    const auto found = load_row_index(path, wanted);
+    BgzfReader rd(path);
+    for (const auto& n : names) {
+      auto it = found.find(n);
+      if (it == found.end()) throw std::runtime_error("Row " + n + " not in " + path);
+      rd.seek(it->second);
+      if (rd.read(row.data(), ncols * sizeof(float)) != ncols * sizeof(float))
+        throw std::runtime_error("Truncated row " + n + " in " + path);
+      emit(n);
+    }
+    return;
+  }
+
+  const auto rows = read_names(dir + json_field(json, "rows"));
+  std::unordered_map<std::string, std::size_t> rowIdx;
+  for (std::size_t r = 0; r < rows.size(); ++r)
+    if (wanted.count(rows[r])) rowIdx.emplace(rows[r], r);
+
+  std::FILE* fh = std::fopen(path.c_str(), "rb");
+  if (!fh) throw std::runtime_error("Cannot open " + path);
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> guard(fh, std::fclose);
+  for (const auto& n : names) {
+    auto it = rowIdx.find(n);
+    if (it == rowIdx.end()) throw std::runtime_error("Row " + n + " not in " + path);
+    const off_t pos = static_cast<off_t>(offset + it->second * ncols * sizeof(float));
+    if (fseeko(fh, pos, SEEK_SET) != 0 ||
+        std::fread(row.data(), sizeof(float), ncols, fh) != ncols)
+      throw std::runtime_error("Truncated row " + n + " in " + path);
+    emit(n);
+  }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "combine_core.hpp"
+
+/*
+------------------------------------------------------------------------------
+ Writers for the combined matrix.
+  text : gzipped whitespace-delimited text, "%.6f" per cell (the original)
+  npy  : NumPy .npy (float32, C order) holding `total` as-is
+  raw  : little-endian float32 rows back to back
+ The binary formats put row / column names in <out>.rows and <out>.cols
+ (one name per line) and describe themselves in <out>.json, so the matrix
+ file itself can be mmap'ed.
+
+ With `bgzf` the output stream is written as BGZF blocks instead (plain
+ gzip for text, none for binary) and <out>.ridx maps every row name to the
+ virtual offset of its first byte; query_rows() uses that to fetch single
+ rows without inflating the rest of the file.
+
+ With `zstd` (the CLI's choice for an output named *.zst) the stream is
+ zstd-compressed instead, on libzstd's own worker threads, so compression
+ keeps pace with the row formatter where single-threaded gzip could not.
+------------------------------------------------------------------------------
+*/
+
+enum class OutFormat { Text, Npy, Raw };
+
+// "text", "npy" or "raw"; returns false on anything else
+bool parse_out_format(const std::string& s, OutFormat& fmt);
+
+struct WriteOptions {
+  OutFormat format = OutFormat::Text;
+  bool      bgzf   = false;   // BGZF blocks + <out>.ridx row index
+
+  // zstd stream instead (needs libzstd), compressed on `threads` workers
+  bool      zstd      = false;
+  int       zstdLevel = 3;
+  unsigned  threads   = 1;
+};
+
+void write_matrix(const std::string& path, const CombinedMatrix& m,
+                  const WriteOptions& opts);
+
+// The same files, written as the rows arrive (combine_lockstep()).  The
+// matrix passed to begin() supplies names and shape and must outlive end().
+class MatrixWriter : public RowOutput {
+public:
+  MatrixWriter(std::string path, WriteOptions opts);
+  ~MatrixWriter() override;
+
+  void begin(const CombinedMatrix& shape) override;
+  void write_rows(const float* values, std::size_t n) override;
+  void end() override;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+// A combined output (any format above) read back: names and shape from its
+// header or side files, values streamed a batch of rows at a time.
+// Uncompressed binary rows are read(2) straight into the caller's buffer.
+class MatrixReader {
+public:
+  explicit MatrixReader(const std::string& path);
+  ~MatrixReader();
+  MatrixReader(const MatrixReader&)            = delete;
+  MatrixReader& operator=(const MatrixReader&) = delete;
+
+  const std::string& path() const;
+  InputType          type() const;
+  const NameTable&   cols() const;
+  // binary outputs know their row count up front; text ones return 0
+  std::size_t        nrows() const;
+
+  // Up to n more rows into `vals` (n × ncols), each row's name appended to
+  // `names`; returns how many were read, 0 at the end.  Throws on a short
+  // or truncated row.
+  std::size_t read_rows(float* vals, std::size_t n, NameTable& names);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+// Join the outputs of a combine split into row bands (CombineOptions::rows;
+// given in any order) into the full result at `out`, in the bands' own
+// format.  Each band wrote its rows as gzip members / BGZF blocks / zstd
+// frames of their own and recorded where in <band>.band, so they are
+// copied byte for byte, never decompressed.  Throws unless the bands cover
+// every row exactly once with the same columns and format.
+void merge_bands(const std::vector<std::string>& bands, const std::string& out);
+
+// Print the header and the named rows of a combined output (any format
+// written above) as text.  Text outputs need the BGZF row index; binary
+// ones are seeked directly when uncompressed.
+void query_rows(const std::string& path, const std::vector<std::string>& names,
+                std::ostream& out);
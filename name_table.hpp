@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+------------------------------------------------------------------------------
+ Row / column IDs interned in one contiguous char arena plus an offset
+ table: two allocations however many names there are, instead of one
+ std::string object (and often a heap block) per name.  Each name is stored
+ NUL-terminated so c_str() is free.
+ Views returned by operator[] stay valid until the next add() that grows
+ the arena; reserve() up front when views are kept around.
+------------------------------------------------------------------------------
+*/
+
+class NameTable {
+public:
+  NameTable() { offsets_.push_back(0); }
+
+  // room for `names` names totalling `bytes` characters (terminators excluded)
+  void reserve(std::size_t names, std::size_t bytes)
+  {
+    offsets_.reserve(names + 1);
+    arena_.reserve(bytes + names);
+  }
+
+  std::size_t add(std::string_view name)
+  {
+    arena_.insert(arena_.end(), name.begin(), name.end());
+    arena_.push_back('\0');
+    offsets_.push_back(arena_.size());
+    return offsets_.size() - 2;
+  }
+
+  void clear()
+  {
+    arena_.clear();
+    offsets_.assign(1, 0);
+  }
+
+  std::size_t size()  const { return offsets_.size() - 1; }
+  bool        empty() const { return size() == 0; }
+  std::size_t bytes() const { return arena_.size(); }
+
+  std::string_view operator[](std::size_t i) const
+  {
+    return {arena_.data() + offsets_[i], offsets_[i + 1] - offsets_[i] - 1};
+  }
+  const char* c_str(std::size_t i) const { return arena_.data() + offsets_[i]; }
+
+  std::vector<std::string> to_strings() const
+  {
+    std::vector<std::string> out;
+    out.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i) out.emplace_back((*this)[i]);
+    return out;
+  }
+
+  static NameTable from(const std::vector<std::string>& names)
+  {
+    NameTable t;
+    std::size_t bytes = 0;
+    for (const auto& n : names) bytes += n.size();
+    t.reserve(names.size(), bytes);
+    for (const auto& n : names) t.add(n);
+    return t;
+  }
+
+private:
+  std::vector<char>          arena_;
+  std::vector<std::uint64_t> offsets_;   // size() + 1 entries
+};
@@ -0,0 +1,92 @@
+#include "prefetch.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::uint64_t STEP = std::uint64_t{8} << 20;   // bytes per readahead call
+
+// bring [off, off + len) of fd into the page cache; pread into a scratch
+// buffer where readahead(2) is not supported
+void warm(int fd, std::uint64_t off, std::uint64_t len, std::vector<char>& scratch)
+{
+  if (::readahead(fd, static_cast<off64_t>(off), static_cast<std::size_t>(len)) == 0) return;
+  scratch.resize(1 << 20);
+  for (std::uint64_t done = 0; done < len; ) {
+    const ssize_t got = ::pread(fd, scratch.data(),
+                                std::min<std::uint64_t>(scratch.size(), len - done),
+                                static_cast<off_t>(off + done));
+    if (got <= 0) return;
+    done += static_cast<std::uint64_t>(got);
+  }
+}
+
+} // namespace
+
+Prefetcher::Prefetcher(const std::vector<InputFile>& files, std::vector<std::size_t> order,
+                       std::uint64_t budget, unsigned depth)
+  : files_(files), order_(std::move(order)), rank_(files.size()),
+    warmed_(files.size(), 0), begun_(files.size(), 0), budget_(budget), depth_(depth)
+{
+  for (std::size_t k = 0; k < order_.size(); ++k) rank_[order_[k]] = k;
+  thread_ = std::thread([this] { run(); });
+}
+
+Prefetcher::~Prefetcher()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void Prefetcher::started(std::size_t f)
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (begun_[f]) return;
+    begun_[f] = 1;
+    held_ -= warmed_[f];
+    frontier_ = std::max(frontier_, rank_[f] + 1);
+  }
+  cv_.notify_all();
+}
+
+void Prefetcher::run()
+{
+  std::vector<char> scratch;
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stop_) {
+    // first file within `depth` of the frontier that still wants bytes
+    std::size_t f = files_.size();
+    std::uint64_t len = 0;
+    for (std::size_t k = frontier_; k < std::min(order_.size(), frontier_ + depth_); ++k) {
+      const std::size_t g = order_[k];
+      if (begun_[g] || files_[g].stream || warmed_[g] >= files_[g].bytes) continue;
+      len = std::min({files_[g].bytes - warmed_[g], STEP, budget_ - held_});
+      if (len) f = g;
+      break;
+    }
+    if (f == files_.size()) { cv_.wait(lk); continue; }
+
+    const std::uint64_t off = warmed_[f];
+    warmed_[f] += len;   // claimed now, so started() releases it
+    held_      += len;
+    lk.unlock();
+    const int fd = ::open(files_[f].path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      ::posix_fadvise(fd, static_cast<off_t>(off), static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+      warm(fd, off, len, scratch);
+      ::close(fd);
+    }
+    lk.lock();
+    if (fd < 0 && !begun_[f]) {   // give up on it; the parser reports the error
+      begun_[f] = 1;
+      held_    -= warmed_[f];
+    }
+  }
+}
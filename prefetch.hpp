@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "inputs.hpp"
+
+/*
+------------------------------------------------------------------------------
+ Input prefetching.  While one file is parsed, a background thread pulls
+ the compressed bytes of the next `depth` files (in the order they will be
+ read) into the page cache: posix_fadvise(WILLNEED) to start the kernel's
+ readahead, then readahead(2) in chunks so the bytes really are in memory
+ when the parser opens the file, even on network filesystems that ignore
+ the hint.  At most `budget` bytes are held for files not started yet;
+ a file's bytes leave the budget once it is being read.  Streams are never
+ touched.
+------------------------------------------------------------------------------
+*/
+
+class Prefetcher {
+public:
+  // `order`: file indices in the order they will be opened
+  Prefetcher(const std::vector<InputFile>& files, std::vector<std::size_t> order,
+             std::uint64_t budget, unsigned depth = 2);
+  ~Prefetcher();
+  Prefetcher(const Prefetcher&)            = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
+
+  // file f is being opened now: warm the ones after it
+  void started(std::size_t f);
+
+private:
+  void run();
+
+  const std::vector<InputFile>& files_;
+  std::vector<std::size_t>      order_;
+  std::vector<std::size_t>      rank_;     // position of each file in order_
+  std::vector<std::uint64_t>    warmed_;   // bytes of each file read ahead
+  std::vector<char>             begun_;
+  std::uint64_t                 budget_;
+  std::uint64_t                 held_ = 0;   // warmed bytes of files not begun
+  unsigned                      depth_;
+  std::size_t                   frontier_ = 0;   // rank after the last begun
+
+  std::mutex              mu_;
+  std::condition_variable cv_;
+  bool                    stop_ = false;
+  std::thread             thread_;
+};
@@ -0,0 +1,92 @@
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include "combine_core.hpp"
+
+/*
+------------------------------------------------------------------------------
+ Python bindings:  combinepbwt.combine(files, type=..., threads=..., weights=...,
+                                       align=..., master_ids=..., union=..., mean=...)
+ returns (row_names, col_names, matrix) where `matrix` is a float32 NumPy
+ array viewing the accumulator itself – no text output, no copy.
+------------------------------------------------------------------------------
+*/
+
+namespace py = pybind11;
+
+static py::tuple combine(const std::vector<std::string>& files,
+                         const std::string&              type,
+                         unsigned                        threads,
+                         const std::vector<float>&       weights,
+                         bool                            align,
+                         const std::string&              master_ids,
+                         bool                            union_ids,
+                         bool                            mean)
+{
+  if (!weights.empty() && weights.size() != files.size())
+    throw py::value_error("weights must have one entry per file");
+  std::vector<InputFile> inputs;
+  for (std::size_t i = 0; i < files.size(); ++i)
+    inputs.push_back({files[i], weights.empty() ? 1.0f : weights[i]});
+
+  CombineOptions opts;
+  if (!parse_input_type(type, opts.type))
+    throw py::value_error("type must be pbwt, chromopainter, or SparsePainter");
+  opts.threads   = threads ? threads : 1;
+  opts.align     = align;
+  opts.masterIds = master_ids;
+  opts.unionIds  = union_ids;
+
+  auto m = std::make_unique<CombinedMatrix>();
+  {
+    py::gil_scoped_release nogil;
+    *m = combine_files(std::move(inputs), opts);
+    if (mean) mean_over_present(*m);
+  }
+
+  py::list rows(m->rowNames.size()), cols(m->colNames.size());
+  for (std::size_t i = 0; i < m->rowNames.size(); ++i) {
+    const auto n = m->rowNames[i];
+    rows[i] = py::str(n.data(), n.size());
+  }
+  for (std::size_t i = 0; i < m->colNames.size(); ++i) {
+    const auto n = m->colNames[i];
+    cols[i] = py::str(n.data(), n.size());
+  }
+
+  // hand ownership of the accumulator to the array's base object
+  const auto nrows = static_cast<py::ssize_t>(m->nrows);
+  const auto ncols = static_cast<py::ssize_t>(m->ncols);
+  float*     data  = m->total.data();
+  py::capsule owner(m.release(), [](void* p) {
+    delete static_cast<CombinedMatrix*>(p);
+  });
+  py::array_t<float> matrix({nrows, ncols},
+                            {ncols * static_cast<py::ssize_t>(sizeof(float)),
+                             static_cast<py::ssize_t>(sizeof(float))},
+                            data, owner);
+
+  return py::make_tuple(rows, cols, matrix);
+}
+
+PYBIND11_MODULE(combinepbwt, mod)
+{
+  mod.doc() = "Combine ChromoPainter / pbwt / SparsePainter chunklength matrices";
+  mod.def("combine", &combine,
+          py::arg("files"), py::arg("type") = "pbwt", py::arg("threads") = 1u,
+          py::arg("weights") = std::vector<float>{},
+          py::arg("align") = false, py::arg("master_ids") = "",
+          py::arg("union") = false, py::arg("mean") = false,
+          "Sum the per-chromosome matrices in `files`, optionally scaled by\n"
+          "`weights` (one per file).  With `align` (or a `master_ids` file)\n"
+          "rows and columns are matched by name rather than position; `union`\n"
+          "combines inputs with different sample sets and `mean` divides each\n"
+          "cell by the number of inputs that had it.\n"
+          "Returns (row_names, col_names, float32 ndarray of shape (nrows, ncols)).");
+}
@@ -0,0 +1,94 @@
+#include "row_kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ROW_KERNELS_X86 1
+#endif
+
+/*
+------------------------------------------------------------------------------
+ add_row() variants.  Multiply and add stay separate instructions (no FMA)
+ so every kernel rounds exactly like the scalar dst += w * src; the file is
+ built with -ffp-contract=off so the scalar and tail loops are not
+ contracted into FMA either.  Each vector loop also prefetches the
+ destination a few cache lines ahead; the source is the staging row or
+ batch the parser just wrote, already hot.
+------------------------------------------------------------------------------
+*/
+
+namespace {
+
+constexpr std::size_t AHEAD = 128;   // floats: 8 cache lines
+
+void add_scalar(float* dst, const float* src, std::size_t n, float w)
+{
+  for (std::size_t i = 0; i < n; ++i) dst[i] += w * src[i];
+}
+
+#ifdef ROW_KERNELS_X86
+__attribute__((target("avx2")))
+void add_avx2(float* dst, const float* src, std::size_t n, float w)
+{
+  const __m256 vw = _mm256_set1_ps(w);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __builtin_prefetch(dst + i + AHEAD, 1, 3);
+    const __m256 a = _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                   _mm256_mul_ps(vw, _mm256_loadu_ps(src + i)));
+    const __m256 b = _mm256_add_ps(_mm256_loadu_ps(dst + i + 8),
+                                   _mm256_mul_ps(vw, _mm256_loadu_ps(src + i + 8)));
+    _mm256_storeu_ps(dst + i, a);
+    _mm256_storeu_ps(dst + i + 8, b);
+  }
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                            _mm256_mul_ps(vw, _mm256_loadu_ps(src + i))));
+  for (; i < n; ++i) dst[i] += w * src[i];
+}
+
+__attribute__((target("avx512f")))
+void add_avx512(float* dst, const float* src, std::size_t n, float w)
+{
+  const __m512 vw = _mm512_set1_ps(w);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __builtin_prefetch(dst + i + AHEAD, 1, 3);
+    _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i),
+                                            _mm512_mul_ps(vw, _mm512_loadu_ps(src + i))));
+  }
+  if (i < n) {   // the tail, under a mask
+    const __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+    const __m512 d = _mm512_maskz_loadu_ps(m, dst + i);
+    const __m512 s = _mm512_maskz_loadu_ps(m, src + i);
+    _mm512_mask_storeu_ps(dst + i, m, _mm512_add_ps(d, _mm512_mul_ps(vw, s)));
+  }
+}
+#endif
+
+using Kernel = void (*)(float*, const float*, std::size_t, float);
+
+struct Picked {
+  Kernel      fn;
+  const char* name;
+};
+
+Picked pick()
+{
+#ifdef ROW_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return {add_avx512, "avx512"};
+  if (__builtin_cpu_supports("avx2"))    return {add_avx2, "avx2"};
+#endif
+  return {add_scalar, "scalar"};
+}
+
+const Picked kernel = pick();
+
+} // namespace
+
+void add_row(float* dst, const float* src, std::size_t n, float w)
+{
+  kernel.fn(dst, src, n, w);
+}
+
+const char* add_row_kernel() { return kernel.name; }
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+------------------------------------------------------------------------------
+ Row accumulation kernel.  The parser stages each row's floats contiguously
+ and every accumulation path – straight into the matrix, a band owner's
+ batches, the lockstep batches, the fold of per-thread partials – adds whole
+ rows through add_row().  The widest vector unit the CPU has is picked once
+ at start-up (AVX-512F, AVX2, else a plain loop the compiler vectorises for
+ the build target), so a -march=native binary and a generic one both use it.
+------------------------------------------------------------------------------
+*/
+
+// dst[i] += w * src[i] for i < n (unaligned pointers are fine)
+void add_row(float* dst, const float* src, std::size_t n, float w = 1.0f);
+
+// "avx512", "avx2" or "scalar": the kernel add_row() dispatches to
+const char* add_row_kernel();
+
+// Ask for the first cache lines of a row about to be accumulated into, so a
+// scattered destination (band batches, aligned rows) is on its way while
+// the current row is added.
+inline void prefetch_row(const float* row, std::size_t n)
+{
+  const std::size_t lines = n < 128 ? n : 128;   // at most 8 cache lines
+  for (std::size_t i = 0; i < lines; i += 16) __builtin_prefetch(row + i, 1, 3);
+}
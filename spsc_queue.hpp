@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/*
+------------------------------------------------------------------------------
+ Bounded lock-free single-producer / single-consumer ring of T (meant for
+ pointers).  One thread may push, one other thread may pop; neither ever
+ blocks – a full push or empty pop just returns false.
+------------------------------------------------------------------------------
+*/
+
+template <class T>
+class SpscQueue {
+public:
+  explicit SpscQueue(std::size_t capacity = 16)
+  {
+    std::size_t n = 2;
+    while (n < capacity + 1) n <<= 1;   // one slot stays empty
+    slots_.resize(n);
+    mask_ = n - 1;
+  }
+  SpscQueue(const SpscQueue&)            = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  bool push(const T& v)
+  {
+    const std::size_t h = head_.load(std::memory_order_relaxed);
+    const std::size_t next = (h + 1) & mask_;
+    if (next == tail_.load(std::memory_order_acquire)) return false;
+    slots_[h] = v;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& v)
+  {
+    const std::size_t t = tail_.load(std::memory_order_relaxed);
+    if (t == head_.load(std::memory_order_acquire)) return false;
+    v = slots_[t];
+    tail_.store((t + 1) & mask_, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::vector<T> slots_;
+  std::size_t    mask_ = 0;
+  alignas(64) std::atomic<std::size_t> head_{0};   // written by the producer
+  alignas(64) std::atomic<std::size_t> tail_{0};   // written by the consumer
+};
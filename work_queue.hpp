@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+------------------------------------------------------------------------------
+ Work-stealing task queues: one deque per worker.  A worker takes from the
+ front of its own deque; once that is empty it steals from the back of
+ whichever deque has the most tasks left, so the tail of a job stays
+ parallel however unevenly the tasks were dealt out.
+ Tasks are coarse (megabytes of input each), so a mutex per deque is plenty.
+------------------------------------------------------------------------------
+*/
+
+template <class T>
+class StealQueues {
+public:
+  explicit StealQueues(unsigned workers) : q_(workers)
+  {
+    for (auto& q : q_) q = std::make_unique<Queue>();
+  }
+
+  unsigned workers() const { return static_cast<unsigned>(q_.size()); }
+
+  // before the workers start (or from worker `w` itself)
+  void push(unsigned w, T task)
+  {
+    Queue& q = *q_[w];
+    std::lock_guard<std::mutex> lk(q.mu);
+    q.tasks.push_back(std::move(task));
+    q.size.store(q.tasks.size(), std::memory_order_relaxed);
+  }
+
+  // next task for worker `self`; false once every deque is empty
+  bool next(unsigned self, T& task)
+  {
+    if (take(*q_[self], task, true)) return true;
+    while (true) {
+      Queue* victim = nullptr;
+      std::size_t most = 0;
+      for (auto& q : q_) {
+        const std::size_t n = q->size.load(std::memory_order_relaxed);
+        if (n > most) { most = n; victim = q.get(); }
+      }
+      if (!victim) return false;
+      if (take(*victim, task, false)) return true;   // else lost a race: rescan
+    }
+  }
+
+  // drop everything still queued (a worker failed)
+  void clear()
+  {
+    for (auto& q : q_) {
+      std::lock_guard<std::mutex> lk(q->mu);
+      q->tasks.clear();
+      q->size.store(0, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  struct Queue {
+    std::mutex               mu;
+    std::deque<T>            tasks;
+    std::atomic<std::size_t> size{0};
+  };
+
+  static bool take(Queue& q, T& task, bool front)
+  {
+    std::lock_guard<std::mutex> lk(q.mu);
+    if (q.tasks.empty()) return false;
+    if (front) { task = std::move(q.tasks.front()); q.tasks.pop_front(); }
+    else       { task = std::move(q.tasks.back());  q.tasks.pop_back();  }
+    q.size.store(q.tasks.size(), std::memory_order_relaxed);
+    return true;
+  }
+
+  std::vector<std::unique_ptr<Queue>> q_;
+};